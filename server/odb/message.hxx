@@ -19,6 +19,8 @@ namespace blus {
             _message_type(message_type), _create_time(create_time) {
         }
 
+        unsigned long id() const { return _id; }
+        void id(unsigned long id) { _id = id; }
         std::string message_id() const { return _message_id; }
         void message_id(const std::string& mid) { _message_id = mid; }
         std::string user_id() const { return _user_id; }
@@ -45,7 +47,7 @@ namespace blus {
         std::string _message_id;
 #pragma db type("varchar(64)")
         std::string _user_id;
-#pragma db type("varchar(64)") index
+#pragma db type("varchar(64)")
         std::string _session_id;
         unsigned char _message_type; // 0: text, 1: image, 2: file, 3: audio
 #pragma db type("timestamp")
@@ -58,5 +60,35 @@ namespace blus {
 #pragma db type("varchar(128)")
         odb::nullable<std::string> _file_name;
         odb::nullable<unsigned int> _file_size;
+
+        // 会话内按时间倒序翻页(keyset分页)的复合索引，前缀同时服务按会话查询/删除
+#pragma db index("message_session_time_i") members(_session_id, _create_time, _id)
+        // 按时间归档冷分区时的导出/清理
+#pragma db index("message_time_i") members(_create_time, _id)
+    };
+
+    // 消息归档的全局状态，只有一行(id为kId)，保存在默认分片
+    // 所有实例共用归档水位；归档租约保证同一时间只有一个实例导出和清理热表
+#pragma db object table("message_archive_state")
+    class MessageArchiveState {
+    public:
+        static constexpr unsigned int kId = 1;
+        MessageArchiveState() = default;
+
+        // 未归档过时早于任何消息
+        boost::posix_time::ptime horizon() const {
+            return _horizon ? *_horizon : boost::posix_time::ptime(boost::posix_time::min_date_time);
+        }
+        std::string owner() const { return _owner ? *_owner : ""; }
+    private:
+        friend class odb::access;
+#pragma db id
+        unsigned int _id = kId;
+#pragma db type("DATETIME(6)")
+        odb::nullable<boost::posix_time::ptime> _horizon;
+#pragma db type("varchar(64)")
+        odb::nullable<std::string> _owner; // 持有归档租约的实例
+#pragma db type("DATETIME(6)")
+        odb::nullable<boost::posix_time::ptime> _lease_until;
     };
 } // namespace blus
@@ -47,6 +47,11 @@ namespace blus {
         }
         void avatar_id(const std::string& avatar_id) { _avatar_id = avatar_id; }
 
+        std::string avatar_hash() const {
+                return _avatar_hash ? *_avatar_hash : std::string{};
+        }
+        void avatar_hash(const std::string& avatar_hash) { _avatar_hash = avatar_hash; }
+
     private:
         friend class odb::access;
 
@@ -64,5 +69,7 @@ namespace blus {
         odb::nullable<std::string> _email;
 #pragma db type("char(16)")
         odb::nullable<std::string> _avatar_id;
+#pragma db type("char(64)")
+        odb::nullable<std::string> _avatar_hash; // 头像内容的sha256, 上传时计算
     };
 } // namespace blus
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "rabbitmq.hpp"
+#include "logger.hpp"
+
+namespace blus {
+    // 会话成员变更，消息体为会话ID
+    inline constexpr const char* kMemberChangeExchange = "chat_session_member_change";
+    // 用户资料(昵称/签名/邮箱/头像)变更，消息体为用户ID
+    inline constexpr const char* kProfileChangeExchange = "user_profile_change";
+
+    // 数据变更事件，用于失效其他服务的本地缓存
+    // 修改数据的一方调用publish发布变更对象的ID；
+    // 缓存数据的各实例各自声明一个绑定到fanout交换机的自动删除队列，收到事件后失效本地缓存
+    // 实例断开期间的事件会丢失，由缓存的TTL兜底
+    class ChangeEvents {
+    public:
+        using Ptr = std::shared_ptr<ChangeEvents>;
+
+        ChangeEvents(const RabbitMQ::Ptr& mq, const std::string& exchange) : _mq(mq), _exchange(exchange) {
+            _mq->declareExchange(_exchange, AMQP::ExchangeType::fanout);
+        }
+
+        void publish(const std::string& id) {
+            if (!_mq->publish(_exchange, "", id)) {
+                LOG_ERROR("发布变更事件失败{}: {}", _exchange, id);
+            }
+        }
+
+        // instance_name区分各实例的队列，保证每个实例都收到全部事件
+        void subscribe(const std::string& instance_name, const std::function<void(const std::string&)>& callback) {
+            std::string queue = _exchange + "." + instance_name;
+            _mq->declareComponents(_exchange, queue, "", AMQP::ExchangeType::fanout, AMQP::autodelete);
+            _mq->consume(queue, callback);
+        }
+    private:
+        RabbitMQ::Ptr _mq;
+        std::string _exchange;
+    };
+} // namespace blus
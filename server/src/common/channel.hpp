@@ -2,175 +2,1124 @@
 #include <iostream>
 #include <string>
 #include <memory>
-#include <queue>
+#include <vector>
+#include <unordered_set>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
 #include <brpc/channel.h>
+#include <brpc/builtin_service.pb.h>
+#include <brpc/controller.h>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <butil/containers/doubly_buffered_data.h>
+#include <butil/time.h>
+#include <google/protobuf/stubs/callback.h>
 
 #include "logger.hpp"
+#include "load.hpp"
 
 namespace blus {
     using ChannelPtr = std::shared_ptr<brpc::Channel>;
 
-    class ServiceChannel {
-    public:
-        using Ptr = std::shared_ptr<ServiceChannel>;
-        // 定义信道状态结构体
-        struct ChannelStatus {
-            ChannelPtr channel;
-            int busy_level; // 忙碌程度，值越小越不忙碌
+    // 单调时钟的当前时间(微秒)
+    inline int64_t steady_now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 定义信道状态结构体
+    // 节点集合变化时发布新的只读快照，状态对象在快照间共享，计数均为原子变量
+    struct ChannelStatus {
+        std::string ip_port;
+        ChannelPtr channel;
+        std::atomic<int> busy_level; // 忙碌程度(在途请求数)，值越小越不忙碌
+        std::atomic<int64_t> latency_us; // 请求完成耗时的指数加权平均值(微秒)，0表示尚无样本
+        // 异常摘除(熔断)相关状态
+        std::atomic<int> consecutive_failures; // 连续失败次数
+        std::atomic<int> error_permille; // 错误率的指数加权平均值(千分比)
+        std::atomic<int> samples; // 自上次恢复以来完成的请求数，用于错误率的最小样本判断
+        std::atomic<int64_t> ejected_until_us; // 0: 正常; 否则摘除到该时刻，之后进入半开状态等待探测
+        std::atomic<int> ejection_count; // 连续摘除次数，决定退避时长
+        std::atomic<bool> probing; // 半开状态下是否已有探测请求在途
+        // 节点上报的负载(见LoadRecord)，未上报时所有节点权重相同
+        std::atomic<int> weight; // 有效权重: 容量权重按CPU余量折算
+        std::atomic<int> queue_depth; // 节点上排队等待处理的请求数(含其他调用方)
+        // 主动健康检查(见ServiceManager)，不依赖业务流量，能在etcd租约过期前发现崩溃的节点
+        std::atomic<bool> healthy; // 连续探测失败达到阈值后置为false，探测成功后恢复
+        std::atomic<int> probe_failures; // 连续健康探测失败次数
+        std::atomic<int64_t> rtt_us; // 健康探测往返时间的指数加权平均值(微秒)，0表示尚无样本
+
+        static constexpr int kDefaultWeight = 100;
+
+        ChannelStatus(const std::string& addr, ChannelPtr ch, int level)
+            : ip_port(addr), channel(ch), busy_level(level), latency_us(0)
+            , consecutive_failures(0), error_permille(0), samples(0)
+            , ejected_until_us(0), ejection_count(0), probing(false)
+            , weight(kDefaultWeight), queue_depth(0)
+            , healthy(true), probe_failures(0), rtt_us(0) {
+        }
 
-            ChannelStatus(ChannelPtr ch, int level) : channel(ch), busy_level(level) {}
+        // 负载: 本调用方的在途请求与节点排队请求之和，用于加权比较
+        int load() const {
+            return busy_level.load(std::memory_order_relaxed) + queue_depth.load(std::memory_order_relaxed);
+        }
+
+        // 未被摘除且健康检查正常，可参与正常选择
+        bool available() const {
+            return ejected_until_us.load(std::memory_order_relaxed) == 0 && healthy.load(std::memory_order_relaxed);
+        }
+    };
+    using ChannelStatusPtr = std::shared_ptr<ChannelStatus>;
+
+    // 稳定的64位哈希(FNV-1a + murmur3 finalizer)，不同进程对同一key结果一致
+    inline uint64_t stable_hash(const std::string& key) {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
 
-            // 重载比较运算符，用于小根堆
-            bool operator>(const ChannelStatus& other) const {
-                return busy_level > other.busy_level;
+    // 某服务当前可选节点的只读快照
+    struct ChannelSnapshot {
+        std::vector<ChannelStatusPtr> nodes;
+        // 一致性哈希环: (虚拟节点哈希, nodes下标)，按哈希升序
+        // 节点增删时只有相邻区间的key迁移，各调用方对同一节点集合构建出的环相同
+        std::vector<std::pair<uint64_t, uint32_t>> ring;
+
+        static constexpr int kVirtualNodes = 160; // 每个节点的虚拟节点数
+
+        void build_ring() {
+            ring.clear();
+            ring.reserve(nodes.size() * kVirtualNodes);
+            for (uint32_t i = 0; i < nodes.size(); ++i) {
+                for (int v = 0; v < kVirtualNodes; ++v) {
+                    ring.emplace_back(stable_hash(nodes[i]->ip_port + "#" + std::to_string(v)), i);
+                }
             }
-        };
+            std::sort(ring.begin(), ring.end());
+        }
 
-        ServiceChannel(const std::string& service_name)
-            : _service_name(service_name)
-            , _channel_heap(std::greater<ChannelStatus>(), std::vector<ChannelStatus>()) {
+        // 顺时针查找affinity_key落到的节点，跳过被摘除的节点；全部被摘除时返回原始落点
+        ChannelStatusPtr locate(const std::string& affinity_key) const {
+            if (ring.empty()) {
+                return nullptr;
+            }
+            auto it = std::lower_bound(ring.begin(), ring.end(),
+                std::make_pair(stable_hash(affinity_key), static_cast<uint32_t>(0)));
+            size_t start = it == ring.end() ? 0 : it - ring.begin();
+            for (size_t i = 0; i < ring.size(); ++i) {
+                const auto& status = nodes[ring[(start + i) % ring.size()].second];
+                if (status->available()) {
+                    return status;
+                }
+            }
+            return nodes[ring[start].second];
         }
+    };
 
-        // 添加信道
-        void append(const std::string& ip_port) {
-            brpc::ChannelOptions options;
-            options.timeout_ms = -1;
-            options.connect_timeout_ms = -1;
-            options.max_retry = 3;
+    // 负载均衡策略
+    enum class LoadBalancePolicy {
+        LEAST_BUSY, // 在途请求数最少
+        P2C, // 随机两选一，按 在途请求数 x 耗时EWMA 打分
+    };
 
-            ChannelPtr channel = std::make_shared<brpc::Channel>();
-            if (channel->Init(ip_port.c_str(), &options) == 0) {
-                std::lock_guard<std::mutex> lock(_mutex);
-                ChannelStatus status(channel, 0);
-                _channel_heap.push(status);
-                _ip_port_map.emplace(ip_port, status);
+    // 负载均衡器接口，select在读快照时无锁调用，实现只能依赖原子计数
+    // 实现应跳过被摘除的节点，全部被摘除时退化为在所有节点中选择
+    class LoadBalancer {
+    public:
+        using Ptr = std::unique_ptr<LoadBalancer>;
+        virtual ~LoadBalancer() = default;
+
+        // 从快照中选出一个节点，为空时返回nullptr
+        virtual ChannelStatusPtr select(const ChannelSnapshot& snapshot) = 0;
+
+        static Ptr create(LoadBalancePolicy policy);
+    };
+
+    // 扫描快照选取 (负载+1)/权重 最小的节点，起点轮转以打散相同负载的节点
+    // 节点数为几十量级，无锁的O(n)扫描代价低于全局锁下维护堆
+    class LeastBusyBalancer : public LoadBalancer {
+    public:
+        ChannelStatusPtr select(const ChannelSnapshot& snapshot) override {
+            const auto& nodes = snapshot.nodes;
+            if (nodes.empty()) {
+                return nullptr;
             }
-            else {
-                LOG_ERROR("Failed to initialize channel for {}-{}", _service_name, ip_port);
+            size_t n = nodes.size();
+            size_t start = _cursor.fetch_add(1, std::memory_order_relaxed) % n;
+            ChannelStatusPtr best;
+            int64_t best_load = 0, best_weight = 1;
+            for (size_t i = 0; i < n; ++i) {
+                const auto& status = nodes[(start + i) % n];
+                if (!status->available()) {
+                    continue;
+                }
+                int64_t load = status->load() + 1;
+                int64_t weight = status->weight.load(std::memory_order_relaxed);
+                // load/weight < best_load/best_weight
+                if (!best || load * best_weight < best_load * weight) {
+                    best = status;
+                    best_load = load;
+                    best_weight = weight;
+                }
             }
+            return best ? best : nodes[start];
+        }
+    private:
+        std::atomic<size_t> _cursor{ 0 };
+    };
+
+    // Power of two choices: 随机取两个节点，选 (负载+1) x 耗时EWMA / 权重 较小者
+    // 磁盘/机器性能不同的节点即使在途请求数相同，慢节点也会因耗时更高而少分流量
+    class P2CBalancer : public LoadBalancer {
+    public:
+        ChannelStatusPtr select(const ChannelSnapshot& snapshot) override {
+            const auto& nodes = snapshot.nodes;
+            if (nodes.size() < 2) {
+                return nodes.empty() ? nullptr : nodes.front();
+            }
+            thread_local std::mt19937 rng{ std::random_device{}() };
+            std::uniform_int_distribution<size_t> dist(0, nodes.size() - 1);
+            // 随机抽取未被摘除的候选，多次抽不中时退化为顺序查找
+            auto draw = [&](size_t exclude) -> size_t {
+                for (int i = 0; i < kDrawAttempts; ++i) {
+                    size_t index = dist(rng);
+                    if (index != exclude && nodes[index]->available()) {
+                        return index;
+                    }
+                }
+                for (size_t index = 0; index < nodes.size(); ++index) {
+                    if (index != exclude && nodes[index]->available()) {
+                        return index;
+                    }
+                }
+                return nodes.size();
+            };
+            size_t a = draw(nodes.size());
+            if (a == nodes.size()) {
+                return nodes[dist(rng)];
+            }
+            size_t b = draw(a);
+            if (b == nodes.size()) {
+                return nodes[a];
+            }
+            return score(nodes[a]) <= score(nodes[b]) ? nodes[a] : nodes[b];
+        }
+    private:
+        static constexpr int kDrawAttempts = 4;
+
+        static double score(const ChannelStatusPtr& status) {
+            // 尚无耗时样本的节点按1us计，使新节点优先获得探测流量
+            int64_t latency = status->latency_us.load(std::memory_order_relaxed);
+            return (status->load() + 1) * static_cast<double>(latency > 0 ? latency : 1)
+                / status->weight.load(std::memory_order_relaxed);
+        }
+    };
+
+    inline LoadBalancer::Ptr LoadBalancer::create(LoadBalancePolicy policy) {
+        switch (policy) {
+        case LoadBalancePolicy::P2C:
+            return std::make_unique<P2CBalancer>();
+        case LoadBalancePolicy::LEAST_BUSY:
+        default:
+            return std::make_unique<LeastBusyBalancer>();
+        }
+    }
+
+    // 对冲请求配置: 首个请求超过该服务耗时分位数仍未返回时，向另一节点发送副本，取先成功返回者
+    // 仅适用于幂等的读请求；对冲额度按请求数的budget_ratio积累，避免故障时放大负载
+    struct HedgeOptions {
+        bool enabled = false;
+        double percentile = 0.95; // 对冲延迟取最近请求耗时的该分位数
+        int64_t min_delay_ms = 5; // 对冲延迟下限，样本不足时使用该值
+        double budget_ratio = 0.1; // 每个请求积累的对冲额度，即对冲请求占比上限
+        int burst = 10; // 对冲额度上限，允许短时突发
+    };
+
+    class ChannelLease;
+
+    // 单个服务的信道管理
+    // 读路径(get/acquire/归还)只读取DoublyBufferedData快照并操作原子计数，不竞争全局锁
+    // 写路径(append/remove，由etcd watcher触发)持_mutex修改节点表后发布新快照
+    // 异常节点(连续失败、错误率过高、耗时远高于同伴)会被临时摘除，摘除时长指数退避，
+    // 到期后进入半开状态，只放行一个探测请求，探测成功才恢复
+    // 健康检查(check_health，由ServiceManager周期调用)不通过的节点同样不参与选择
+    class ServiceChannel : public std::enable_shared_from_this<ServiceChannel> {
+    public:
+        using Ptr = std::shared_ptr<ServiceChannel>;
+        using StatusPtr = ChannelStatusPtr;
+
+        ServiceChannel(const std::string& service_name, LoadBalancePolicy policy = LoadBalancePolicy::LEAST_BUSY,
+            const HedgeOptions& hedge = HedgeOptions())
+            : _service_name(service_name)
+            , _balancer(LoadBalancer::create(policy))
+            , _hedge(hedge) {
+        }
+
+        // 添加信道
+        // warmup为true时先通过brpc内置的health服务探测节点，连接建立后才加入可选集合，预热在后台线程进行，
+        // 不阻塞etcd回调及ServiceManager的锁；服务当前没有可选节点时(如进程启动)直接加入，只在后台建立连接
+        void append(const std::string& ip_port, bool warmup = false) {
+            apply({ ip_port }, {}, warmup);
         }
 
         // 下线指定的信道
         void remove(const std::string& ip_port) {
-            std::lock_guard<std::mutex> lock(_mutex);
-            auto it = _ip_port_map.find(ip_port);
-            if (it != _ip_port_map.end()) {
-                std::priority_queue<ChannelStatus, std::vector<ChannelStatus>, std::greater<ChannelStatus>> temp_heap{ std::greater<ChannelStatus>(), std::vector<ChannelStatus>() };
-                while (!_channel_heap.empty()) {
-                    auto status = _channel_heap.top();
-                    _channel_heap.pop();
-                    if (status.channel != it->second.channel) {
-                        temp_heap.push(status);
+            apply({}, { ip_port });
+        }
+
+        // 以一次变更应用一批节点的上下线，无论批次大小只发布一次快照
+        // 需要预热的新节点在预热完成后再一起发布一次
+        void apply(const std::vector<std::string>& online, const std::vector<std::string>& offline, bool warmup = false) {
+            std::vector<StatusPtr> created;
+            for (const auto& ip_port : online) {
+                if (auto status = create(ip_port)) {
+                    created.push_back(status);
+                }
+            }
+            std::vector<StatusPtr> warming;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                bool changed = false;
+                for (const auto& ip_port : offline) {
+                    if (_warming.erase(ip_port)) {
+                        LOG_DEBUG("节点{}-{}在预热期间下线", _service_name, ip_port);
+                        continue;
+                    }
+                    auto it = _ip_port_map.find(ip_port);
+                    if (it == _ip_port_map.end()) {
+                        LOG_WARN("Remove channel {}-{} not found", _service_name, ip_port);
+                        continue;
+                    }
+                    forget(it->second);
+                    _ip_port_map.erase(it);
+                    changed = true;
+                }
+                // 没有可选节点时等待预热只会让请求全部失败
+                bool cold = _ip_port_map.empty();
+                for (const auto& status : created) {
+                    if (_ip_port_map.count(status->ip_port) || _warming.count(status->ip_port)) {
+                        LOG_WARN("Append channel {}-{} already exists", _service_name, status->ip_port);
+                        continue;
+                    }
+                    if (warmup && cold) {
+                        _ip_port_map.emplace(status->ip_port, status);
+                        warming.push_back(status);
+                        changed = true;
                     }
+                    else if (warmup) {
+                        _warming[status->ip_port] = status;
+                        warming.push_back(status);
+                    }
+                    else {
+                        _ip_port_map.emplace(status->ip_port, status);
+                        changed = true;
+                    }
+                }
+                if (changed) {
+                    publish();
                 }
-                _channel_heap = std::move(temp_heap);
-                _ip_port_map.erase(it); // 从映射中移除
             }
-            else {
-                LOG_WARN("Remove channel {}-{} not found", _service_name, ip_port);
+            if (warming.empty()) {
+                return;
             }
+            std::thread(&ServiceChannel::warm, shared_from_this(), warming).detach();
         }
 
         // 下线最不忙碌的信道
         void remove_least_busy() {
             std::lock_guard<std::mutex> lock(_mutex);
-            if (_channel_heap.empty()) {
-                return;
-            }
-            auto least_busy = _channel_heap.top();
-            _channel_heap.pop();
+            auto least_busy = _ip_port_map.end();
             for (auto it = _ip_port_map.begin(); it != _ip_port_map.end(); ++it) {
-                if (it->second.channel == least_busy.channel) {
-                    _ip_port_map.erase(it);
-                    break;
+                if (least_busy == _ip_port_map.end() || it->second->busy_level < least_busy->second->busy_level) {
+                    least_busy = it;
                 }
             }
+            if (least_busy != _ip_port_map.end()) {
+                forget(least_busy->second);
+                _ip_port_map.erase(least_busy);
+                publish();
+            }
         }
 
-        // 获取最不忙碌的信道
+        // 按负载均衡策略获取信道
+        // 注意: 该接口不计入忙碌程度，适用于长期持有信道的场景（如测试客户端）
+        // 单次RPC请使用acquire()/ServiceManager::lease()，请求完成时自动归还
         ChannelPtr get() {
-            std::lock_guard<std::mutex> lock(_mutex);
-            if (_channel_heap.empty()) {
+            auto status = select();
+            if (!status) {
                 LOG_WARN("没有可用的节点，服务名：{}", _service_name);
                 return nullptr;
             }
-            auto least_busy = _channel_heap.top();
-            _channel_heap.pop();
-            // 使用该信道前，将其忙碌程度加1
-            least_busy.busy_level++;
-            _channel_heap.push(least_busy);
-
-            // // 更新映射中的忙碌程度
-            // for (auto& pair : _ip_port_map) {
-            //     if (pair.second.channel == least_busy.channel) {
-            //         pair.second.busy_level = least_busy.busy_level;
-            //         break;
-            //     }
-            // }
+            return status->channel;
+        }
 
-            return least_busy.channel;
+        // 按affinity_key在一致性哈希环上获取信道（不计入忙碌程度）
+        ChannelPtr get(const std::string& affinity_key) {
+            auto status = locate(affinity_key);
+            if (!status) {
+                LOG_WARN("没有可用的节点，服务名：{}", _service_name);
+                return nullptr;
+            }
+            return status->channel;
         }
 
+        // 按负载均衡策略租用信道，租约析构时自动归还并记录请求耗时
+        ChannelLease acquire();
+        // 按affinity_key在一致性哈希环上租用信道，相同key总是落到同一节点
+        ChannelLease acquire(const std::string& affinity_key);
+
+        // 同步调用RPC，成功与否由cntl给出；服务开启对冲时，首个请求超时未返回会向另一节点发送副本
+        // 注意: 开启对冲时method必须是幂等的读请求
+        template <typename Stub, typename Request, typename Response>
+        void call(void (Stub::*method)(google::protobuf::RpcController*, const Request*, Response*, google::protobuf::Closure*),
+            brpc::Controller* cntl, const Request* request, Response* response);
+
         // 请求完成后，更新信道的忙碌程度（客户端进行此调用）
         void request_completed(ChannelPtr channel) {
-            std::lock_guard<std::mutex> lock(_mutex);
-            std::priority_queue<ChannelStatus, std::vector<ChannelStatus>, std::greater<ChannelStatus>> temp_heap{ std::greater<ChannelStatus>(), std::vector<ChannelStatus>() };
-            while (!_channel_heap.empty()) {
-                auto status = _channel_heap.top();
-                _channel_heap.pop();
-                if (status.channel == channel && status.busy_level > 0) {
-                    status.busy_level--; // 忙碌程度减1
+            if (!channel) {
+                return;
+            }
+            if (auto status = find([&](const StatusPtr& s) { return s->channel == channel; })) {
+                decrease(status);
+            }
+        }
+        void request_completed(const std::string& ip_port) {
+            if (auto status = find([&](const StatusPtr& s) { return s->ip_port == ip_port; })) {
+                decrease(status);
+            }
+        }
+
+        // 租约归还时调用，更新忙碌程度、耗时与错误统计，并判断是否需要摘除或恢复节点
+        // probe表示该请求是半开状态下的探测请求；节点已下线时仅更新其自身计数
+        // latency_us为负表示请求被主动取消(如对冲落败)，不计入统计
+        void request_completed(const StatusPtr& status, int64_t latency_us, bool failed = false, bool probe = false) {
+            decrease(status);
+            if (latency_us < 0) {
+                if (probe) {
+                    status->probing.store(false, std::memory_order_relaxed);
+                }
+                return;
+            }
+            if (!failed) {
+                _latency << latency_us;
+                int64_t old = status->latency_us.load(std::memory_order_relaxed);
+                int64_t ewma;
+                do {
+                    ewma = old == 0 ? latency_us
+                        : static_cast<int64_t>(old * (1 - kLatencyAlpha) + latency_us * kLatencyAlpha);
+                } while (!status->latency_us.compare_exchange_weak(old, ewma, std::memory_order_relaxed));
+            }
+            int old_rate = status->error_permille.load(std::memory_order_relaxed);
+            int rate;
+            do {
+                rate = static_cast<int>(old_rate * (1 - kErrorAlpha) + (failed ? 1000 : 0) * kErrorAlpha);
+            } while (!status->error_permille.compare_exchange_weak(old_rate, rate, std::memory_order_relaxed));
+            int samples = status->samples.fetch_add(1, std::memory_order_relaxed) + 1;
+
+            if (probe) {
+                status->probing.store(false, std::memory_order_relaxed);
+            }
+            if (!failed) {
+                status->consecutive_failures.store(0, std::memory_order_relaxed);
+                if (probe) {
+                    restore(status);
+                }
+                else if (latency_us > kSlowFloorUs && status->available() && is_latency_outlier(status)) {
+                    eject(status, "耗时异常");
                 }
-                temp_heap.push(status);
+                return;
+            }
+            int failures = status->consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (probe) {
+                // 半开探测失败，重新摘除并加倍退避
+                eject(status, "探测失败");
+            }
+            else if (!status->available()) {
+                return;
+            }
+            else if (failures >= kMaxConsecutiveFailures) {
+                eject(status, "连续失败");
+            }
+            else if (samples >= kMinErrorSamples && rate >= kMaxErrorPermille) {
+                eject(status, "错误率过高");
+            }
+        }
+
+        // 应用节点上报的负载记录: 有效权重 = 容量权重 x CPU余量(不低于10%)
+        void update_load(const LoadRecord& record) {
+            auto status = find([&](const StatusPtr& s) { return s->ip_port == record.addr; });
+            if (!status) {
+                return;
+            }
+            double headroom = std::max(kMinCpuHeadroom, 1.0 - record.cpu);
+            int weight = std::max(1, static_cast<int>(record.weight * headroom));
+            status->weight.store(weight, std::memory_order_relaxed);
+            status->queue_depth.store(std::max(0, record.queue_depth), std::memory_order_relaxed);
+        }
 
-                // // 更新映射中的忙碌程度
-                // for (auto& pair : _ip_port_map) {
-                //     if (pair.second.channel == status.channel) {
-                //         pair.second.busy_level = status.busy_level;
-                //         break;
-                //     }
-                // }
+        // 对所有节点做一次健康探测: 更新往返时间，连续失败kMaxProbeFailures次标记为不健康，成功即恢复
+        void check_health() {
+            std::vector<StatusPtr> nodes;
+            {
+                Snapshot::ScopedPtr snapshot;
+                if (_snapshot.Read(&snapshot) != 0) {
+                    return;
+                }
+                nodes = snapshot->nodes;
+            }
+            if (nodes.empty()) {
+                return;
             }
-            _channel_heap = std::move(temp_heap);
+            auto rtts = probe(nodes, kHealthTimeoutMs, "健康");
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                const auto& status = nodes[i];
+                if (rtts[i] < 0) {
+                    int failures = status->probe_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+                    if (failures >= kMaxProbeFailures && status->healthy.exchange(false, std::memory_order_relaxed)) {
+                        _unhealthy.fetch_add(1, std::memory_order_relaxed);
+                        LOG_WARN("节点{}-{}连续{}次健康探测失败，停止分配流量", _service_name, status->ip_port, failures);
+                    }
+                    continue;
+                }
+                int64_t old = status->rtt_us.load(std::memory_order_relaxed);
+                status->rtt_us.store(old == 0 ? rtts[i]
+                    : static_cast<int64_t>(old * (1 - kLatencyAlpha) + rtts[i] * kLatencyAlpha), std::memory_order_relaxed);
+                status->probe_failures.store(0, std::memory_order_relaxed);
+                if (!status->healthy.exchange(true, std::memory_order_relaxed)) {
+                    _unhealthy.fetch_sub(1, std::memory_order_relaxed);
+                    LOG_INFO("节点{}-{}健康探测恢复", _service_name, status->ip_port);
+                }
+            }
+        }
+
+        // 当前健康检查不通过的节点数
+        int unhealthy() const {
+            return _unhealthy.load(std::memory_order_relaxed);
+        }
+
+        // 查询指定节点当前的忙碌程度，节点不存在返回-1
+        int busy_level(const std::string& ip_port) {
+            auto status = find([&](const StatusPtr& s) { return s->ip_port == ip_port; });
+            return status ? status->busy_level.load() : -1;
+        }
+
+        // 当前被摘除的节点数
+        int ejected() const {
+            return _ejected.load(std::memory_order_relaxed);
         }
 
         size_t size() {
-            std::lock_guard<std::mutex> lock(_mutex);
-            return _channel_heap.size();
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return 0;
+            }
+            return snapshot->nodes.size();
         }
 
         // DEBUG
         void print() {
-            std::lock_guard<std::mutex> lock(_mutex);
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return;
+            }
             std::cout << "ServiceChannel: " << _service_name << std::endl;
-            std::cout << "ChannelHeap: ";
-            auto temp_heap = _channel_heap;
-            while (!temp_heap.empty()) {
-                auto status = temp_heap.top();
-                temp_heap.pop();
-                std::cout << status.busy_level << " ";
+            std::cout << "Channels: ";
+            for (const auto& status : snapshot->nodes) {
+                std::cout << status->ip_port << "(" << status->busy_level << ", "
+                    << status->latency_us << "us, rtt " << status->rtt_us << "us, " << status->error_permille << "‰, w" << status->weight
+                    << (status->ejected_until_us == 0 ? "" : ", ejected") << (status->healthy ? "" : ", unhealthy") << ") ";
             }
             std::cout << std::endl;
         }
     private:
-        std::mutex _mutex;
+        using Snapshot = butil::DoublyBufferedData<ChannelSnapshot>;
+
+        StatusPtr create(const std::string& ip_port) {
+            // 默认超时仅兜底，单次调用的超时由请求的剩余时间预算设置(见Deadline)
+            brpc::ChannelOptions options;
+            options.timeout_ms = kDefaultTimeoutMs;
+            options.connect_timeout_ms = kConnectTimeoutMs;
+            options.max_retry = 3;
+
+            ChannelPtr channel = std::make_shared<brpc::Channel>();
+            if (channel->Init(ip_port.c_str(), &options) != 0) {
+                LOG_ERROR("Failed to initialize channel for {}-{}", _service_name, ip_port);
+                return nullptr;
+            }
+            return std::make_shared<ChannelStatus>(ip_port, channel, 0);
+        }
+
+        // 预热一批节点: 并发发送health探测以建立连接，失败的节点退避重试
+        // 重试耗尽仍加入可选集合，由异常摘除机制处理，避免探测本身的问题导致节点永久不可用
+        // 已直接加入可选集合的节点(不在_warming中)只建立连接
+        void warm(std::vector<StatusPtr> nodes) {
+            std::vector<StatusPtr> pending = nodes;
+            for (int i = 0; i < kWarmupAttempts && !pending.empty(); ++i) {
+                if (i > 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(kWarmupBackoffMs * i));
+                }
+                auto rtts = probe(pending, kWarmupTimeoutMs, "预热");
+                std::vector<StatusPtr> failed;
+                for (size_t j = 0; j < pending.size(); ++j) {
+                    if (rtts[j] < 0) {
+                        failed.push_back(pending[j]);
+                    }
+                }
+                pending.swap(failed);
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            bool changed = false;
+            for (const auto& status : nodes) {
+                auto it = _warming.find(status->ip_port);
+                if (it == _warming.end() || it->second != status) {
+                    // 预热期间已下线(或下线后重新上线)
+                    continue;
+                }
+                _warming.erase(it);
+                _ip_port_map.emplace(status->ip_port, status);
+                changed = true;
+            }
+            if (changed) {
+                LOG_INFO("{}预热完成{}个节点，{}个探测失败", _service_name, nodes.size(), pending.size());
+                publish();
+            }
+        }
+
+        // 并发向一批节点发送brpc内置的health请求，返回各节点的往返时间(微秒)，失败为-1
+        std::vector<int64_t> probe(const std::vector<StatusPtr>& nodes, int timeout_ms, const char* purpose) {
+            std::vector<brpc::Controller> cntls(nodes.size());
+            std::vector<brpc::HealthRequest> requests(nodes.size());
+            std::vector<brpc::HealthResponse> responses(nodes.size());
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                cntls[i].set_timeout_ms(timeout_ms);
+                cntls[i].set_max_retry(0);
+                brpc::health_Stub stub(nodes[i]->channel.get());
+                stub.default_method(&cntls[i], &requests[i], &responses[i],
+                    google::protobuf::NewCallback(&ServiceChannel::probe_done));
+            }
+            std::vector<int64_t> rtts(nodes.size(), -1);
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                brpc::Join(cntls[i].call_id());
+                if (cntls[i].Failed()) {
+                    LOG_WARN("节点{}-{}{}探测失败: {}", _service_name, nodes[i]->ip_port, purpose, cntls[i].ErrorText());
+                }
+                else {
+                    rtts[i] = cntls[i].latency_us();
+                }
+            }
+            return rtts;
+        }
+
+        static void probe_done() {}
+
+        // 为对冲请求租用除exclude外的另一个可用节点，没有时返回空租约
+        ChannelLease acquire_other(const std::string& exclude);
+
+        // 对冲延迟: 最近请求耗时的分位数，不低于min_delay_ms
+        int64_t hedge_delay_us() const {
+            return std::max(_latency.latency_percentile(_hedge.percentile), _hedge.min_delay_ms * 1000);
+        }
+
+        // 每个请求积累budget_ratio的对冲额度(千分之一为单位)，上限为burst
+        void refill_hedge_budget() {
+            int64_t cap = _hedge.burst * 1000LL;
+            int64_t tokens = _hedge_tokens.load(std::memory_order_relaxed);
+            int64_t next;
+            do {
+                next = std::min(cap, tokens + static_cast<int64_t>(_hedge.budget_ratio * 1000));
+            } while (!_hedge_tokens.compare_exchange_weak(tokens, next, std::memory_order_relaxed));
+        }
+
+        // 消耗一次对冲额度，额度不足返回false
+        bool take_hedge_budget() {
+            int64_t tokens = _hedge_tokens.load(std::memory_order_relaxed);
+            while (tokens >= 1000) {
+                if (_hedge_tokens.compare_exchange_weak(tokens, tokens - 1000, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // 选出节点；存在摘除到期的节点时，优先将本次请求作为其半开探测(每个节点同时只有一个)
+        StatusPtr select(bool* probe = nullptr) {
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return nullptr;
+            }
+            if (probe && _ejected.load(std::memory_order_relaxed) > 0) {
+                int64_t now = steady_now_us();
+                for (const auto& status : snapshot->nodes) {
+                    int64_t until = status->ejected_until_us.load(std::memory_order_relaxed);
+                    bool expected = false;
+                    if (until != 0 && until <= now && status->healthy.load(std::memory_order_relaxed) &&
+                        status->probing.compare_exchange_strong(expected, true, std::memory_order_relaxed)) {
+                        *probe = true;
+                        return status;
+                    }
+                }
+            }
+            return _balancer->select(*snapshot);
+        }
+
+        StatusPtr locate(const std::string& affinity_key) {
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return nullptr;
+            }
+            return snapshot->locate(affinity_key);
+        }
+
+        template <typename Pred>
+        StatusPtr find(Pred pred) {
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return nullptr;
+            }
+            for (const auto& status : snapshot->nodes) {
+                if (pred(status)) {
+                    return status;
+                }
+            }
+            return nullptr;
+        }
+
+        static void decrease(const StatusPtr& status) {
+            // 忙碌程度减1，不减到负数（兼容未计数的get()调用方）
+            int level = status->busy_level.load(std::memory_order_relaxed);
+            while (level > 0 && !status->busy_level.compare_exchange_weak(level, level - 1, std::memory_order_relaxed)) {
+            }
+        }
+
+        // 耗时EWMA是否超过其余可用节点均值的kLatencyOutlierFactor倍
+        bool is_latency_outlier(const StatusPtr& status) {
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return false;
+            }
+            int64_t total = 0;
+            int count = 0;
+            for (const auto& other : snapshot->nodes) {
+                int64_t latency = other->latency_us.load(std::memory_order_relaxed);
+                if (other != status && other->available() && latency > 0) {
+                    total += latency;
+                    count++;
+                }
+            }
+            return count > 0 &&
+                status->latency_us.load(std::memory_order_relaxed) > kLatencyOutlierFactor * total / count;
+        }
+
+        // 摘除节点，摘除时长按连续摘除次数指数退避
+        // 同时被摘除的节点不超过kMaxEjectionPercent，避免大面积故障时把剩余节点压垮
+        void eject(const StatusPtr& status, const char* reason) {
+            int count = status->ejection_count.load(std::memory_order_relaxed);
+            int64_t duration = std::min(kBaseEjectionUs << std::min(count, 10), kMaxEjectionUs);
+            int64_t until = status->ejected_until_us.load(std::memory_order_relaxed);
+            if (until == 0) {
+                size_t total = size();
+                int limit = static_cast<int>(total * kMaxEjectionPercent / 100);
+                if (_ejected.load(std::memory_order_relaxed) >= limit) {
+                    return;
+                }
+                // 仅由第一个成功置位的线程计数
+                if (!status->ejected_until_us.compare_exchange_strong(until, steady_now_us() + duration)) {
+                    return;
+                }
+                _ejected.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                status->ejected_until_us.store(steady_now_us() + duration, std::memory_order_relaxed);
+            }
+            status->ejection_count.fetch_add(1, std::memory_order_relaxed);
+            LOG_WARN("摘除节点 {}-{}: {}, {}ms后探测", _service_name, status->ip_port, reason, duration / 1000);
+        }
+
+        // 探测成功，恢复节点并清空错误统计，退避等级减一
+        void restore(const StatusPtr& status) {
+            int64_t until = status->ejected_until_us.load(std::memory_order_relaxed);
+            if (until == 0 || !status->ejected_until_us.compare_exchange_strong(until, 0)) {
+                return;
+            }
+            _ejected.fetch_sub(1, std::memory_order_relaxed);
+            status->error_permille.store(0, std::memory_order_relaxed);
+            status->samples.store(0, std::memory_order_relaxed);
+            int count = status->ejection_count.load(std::memory_order_relaxed);
+            while (count > 0 && !status->ejection_count.compare_exchange_weak(count, count - 1, std::memory_order_relaxed)) {
+            }
+            LOG_INFO("恢复节点 {}-{}", _service_name, status->ip_port);
+        }
+
+        // 节点下线时撤销其摘除与不健康计数
+        void forget(const StatusPtr& status) {
+            if (!status->healthy.exchange(true, std::memory_order_relaxed)) {
+                _unhealthy.fetch_sub(1, std::memory_order_relaxed);
+            }
+            int64_t until = status->ejected_until_us.load(std::memory_order_relaxed);
+            if (until != 0 && status->ejected_until_us.compare_exchange_strong(until, 0)) {
+                _ejected.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        // 需在持有_mutex时调用，以当前节点表发布新快照
+        void publish() {
+            ChannelSnapshot next;
+            next.nodes.reserve(_ip_port_map.size());
+            for (const auto& [_, status] : _ip_port_map) {
+                next.nodes.push_back(status);
+            }
+            next.build_ring();
+            auto update = [&next](ChannelSnapshot& bg) {
+                bg = next;
+                return static_cast<size_t>(1);
+            };
+            _snapshot.Modify(update);
+        }
+
+        static constexpr int kDefaultTimeoutMs = 3000; // 调用方未设置超时时的默认RPC超时
+        static constexpr int kConnectTimeoutMs = 500; // 建立连接的超时
+        static constexpr int kWarmupAttempts = 3; // 预热探测次数上限
+        static constexpr int kWarmupTimeoutMs = 500; // 单次预热探测超时(含建立连接)
+        static constexpr int kWarmupBackoffMs = 200; // 预热探测的退避间隔
+        static constexpr int kHealthTimeoutMs = 500; // 单次健康探测超时
+        static constexpr int kMaxProbeFailures = 2; // 连续健康探测失败达到该次数即标记为不健康
+        static constexpr double kLatencyAlpha = 0.2; // 耗时EWMA的平滑系数
+        static constexpr double kErrorAlpha = 0.1; // 错误率EWMA的平滑系数
+        static constexpr int kMaxConsecutiveFailures = 5; // 连续失败达到该次数即摘除
+        static constexpr int kMinErrorSamples = 20; // 按错误率摘除所需的最少样本数
+        static constexpr int kMaxErrorPermille = 500; // 错误率达到50%即摘除
+        static constexpr int64_t kSlowFloorUs = 100 * 1000; // 低于该耗时的请求不做耗时异常判断
+        static constexpr int64_t kLatencyOutlierFactor = 5; // 耗时超过同伴均值的倍数
+        static constexpr int64_t kBaseEjectionUs = 1000 * 1000; // 首次摘除时长
+        static constexpr int64_t kMaxEjectionUs = 60 * 1000 * 1000; // 最长摘除时长
+        static constexpr int kMaxEjectionPercent = 50; // 同时被摘除节点的最大比例
+        static constexpr int kHedgeSelectAttempts = 3; // 为对冲请求选择不同节点的尝试次数
+        static constexpr double kMinCpuHeadroom = 0.1; // 折算权重时CPU余量的下限
+
+        std::mutex _mutex; // 仅保护写路径
         std::string _service_name;
-        std::priority_queue<ChannelStatus, std::vector<ChannelStatus>, std::greater<ChannelStatus>> _channel_heap;
-        std::unordered_map<std::string, ChannelStatus> _ip_port_map; // 存储 ip_port 到 ChannelStatus 的映射
+        LoadBalancer::Ptr _balancer;
+        std::unordered_map<std::string, StatusPtr> _ip_port_map; // 存储 ip_port 到 ChannelStatus 的映射（状态对象与快照共享，忙碌程度实时）
+        std::unordered_map<std::string, StatusPtr> _warming; // 预热中、尚未加入可选集合的节点
+        Snapshot _snapshot;
+        std::atomic<int> _ejected{ 0 }; // 当前被摘除的节点数，为0时跳过探测扫描
+        std::atomic<int> _unhealthy{ 0 }; // 当前健康检查不通过的节点数
+        HedgeOptions _hedge;
+        bvar::LatencyRecorder _latency; // 成功请求的耗时分布(微秒)，用于计算对冲延迟
+        std::atomic<int64_t> _hedge_tokens{ 0 }; // 剩余对冲额度
+    };
+
+    // 信道租约: 持有期间计入节点的在途请求数，析构或release()时归还并记录耗时
+    // 同步调用: 栈上持有租约，RPC返回后调用release(cntl.Failed())上报结果
+    // 异步调用: 用wrap(done, &cntl)将租约转移给回调，回调执行时按cntl结果归还
+    // 未显式上报结果时按成功处理
+    class ChannelLease {
+    public:
+        ChannelLease() = default;
+        ChannelLease(const ServiceChannel::Ptr& owner, const ServiceChannel::StatusPtr& status, bool probe = false)
+            : _owner(owner), _status(status), _start(std::chrono::steady_clock::now()), _probe(probe) {
+        }
+        ChannelLease(const ChannelLease&) = delete;
+        ChannelLease& operator=(const ChannelLease&) = delete;
+        ChannelLease(ChannelLease&& other) noexcept { *this = std::move(other); }
+        ChannelLease& operator=(ChannelLease&& other) noexcept {
+            if (this != &other) {
+                release();
+                _owner = std::move(other._owner);
+                _status = std::move(other._status);
+                _start = other._start;
+                _probe = other._probe;
+            }
+            return *this;
+        }
+        ~ChannelLease() { release(); }
+
+        explicit operator bool() const { return _status != nullptr; }
+        brpc::Channel* channel() const { return _status ? _status->channel.get() : nullptr; }
+        const std::string& ip_port() const {
+            static const std::string empty;
+            return _status ? _status->ip_port : empty;
+        }
+
+        // 归还租约，failed表示RPC失败(超时、连接失败等)，计入节点的错误统计；可重复调用
+        void release(bool failed = false) {
+            if (!_status) {
+                return;
+            }
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+            _owner->request_completed(_status, latency, failed, _probe);
+            _status.reset();
+            _owner.reset();
+        }
+
+        // 归还租约但不计入耗时与错误统计，用于被主动取消的请求
+        void discard() {
+            if (!_status) {
+                return;
+            }
+            _owner->request_completed(_status, -1, false, _probe);
+            _status.reset();
+            _owner.reset();
+        }
+
+        // 将租约转移到异步回调中，回调执行前按cntl结果归还租约；done和cntl可以为空
+        google::protobuf::Closure* wrap(google::protobuf::Closure* done, const brpc::Controller* cntl = nullptr) {
+            auto holder = new ChannelLease(std::move(*this));
+            holder->_cntl = cntl;
+            return google::protobuf::NewCallback(&ChannelLease::on_done, holder, done);
+        }
+    private:
+        static void on_done(ChannelLease* lease, google::protobuf::Closure* done) {
+            if (lease->_cntl && lease->_cntl->ErrorCode() == ECANCELED) {
+                lease->discard();
+            }
+            else {
+                lease->release(lease->_cntl && lease->_cntl->Failed());
+            }
+            delete lease;
+            if (done) {
+                done->Run();
+            }
+        }
+
+        ServiceChannel::Ptr _owner;
+        ServiceChannel::StatusPtr _status;
+        std::chrono::steady_clock::time_point _start;
+        bool _probe = false; // 是否为半开探测请求
+        const brpc::Controller* _cntl = nullptr; // 异步回调中据此判断RPC是否失败
     };
 
+    inline ChannelLease ServiceChannel::acquire() {
+        bool probe = false;
+        auto status = select(&probe);
+        if (!status) {
+            LOG_WARN("没有可用的节点，服务名：{}", _service_name);
+            return ChannelLease();
+        }
+        // 使用该信道前，将其忙碌程度加1
+        status->busy_level.fetch_add(1, std::memory_order_relaxed);
+        return ChannelLease(shared_from_this(), status, probe);
+    }
+
+    inline ChannelLease ServiceChannel::acquire(const std::string& affinity_key) {
+        auto status = locate(affinity_key);
+        if (!status) {
+            LOG_WARN("没有可用的节点，服务名：{}", _service_name);
+            return ChannelLease();
+        }
+        status->busy_level.fetch_add(1, std::memory_order_relaxed);
+        return ChannelLease(shared_from_this(), status);
+    }
+
+    inline ChannelLease ServiceChannel::acquire_other(const std::string& exclude) {
+        StatusPtr status;
+        {
+            Snapshot::ScopedPtr snapshot;
+            if (_snapshot.Read(&snapshot) != 0) {
+                return ChannelLease();
+            }
+            for (int i = 0; i < kHedgeSelectAttempts && !status; ++i) {
+                auto candidate = _balancer->select(*snapshot);
+                if (candidate && candidate->ip_port != exclude && candidate->available()) {
+                    status = candidate;
+                }
+            }
+            for (size_t i = 0; i < snapshot->nodes.size() && !status; ++i) {
+                const auto& candidate = snapshot->nodes[i];
+                if (candidate->ip_port != exclude && candidate->available()) {
+                    status = candidate;
+                }
+            }
+        }
+        if (!status) {
+            return ChannelLease();
+        }
+        status->busy_level.fetch_add(1, std::memory_order_relaxed);
+        return ChannelLease(shared_from_this(), status);
+    }
+
+    // 一次对冲调用的共享状态，位于调用方栈上，返回前Join全部请求
+    // 先成功返回的请求胜出；全部失败时以最后返回的请求为准
+    struct HedgeCall {
+        bthread::CountdownEvent event{ 1 };
+        std::atomic<int> pending{ 1 };
+        std::atomic<brpc::Controller*> winner{ nullptr };
+
+        static void done(HedgeCall* call, brpc::Controller* cntl) {
+            int left = call->pending.fetch_sub(1) - 1;
+            brpc::Controller* expected = nullptr;
+            if ((!cntl->Failed() || left == 0) && call->winner.compare_exchange_strong(expected, cntl)) {
+                call->event.signal();
+            }
+        }
+
+        // 放弃已预留计数的对冲请求；主请求已失败返回时由这里把它定为最终结果
+        void abandon(brpc::Controller* primary) {
+            brpc::Controller* expected = nullptr;
+            if (pending.fetch_sub(1) - 1 == 0 && winner.compare_exchange_strong(expected, primary)) {
+                event.signal();
+            }
+        }
+
+        // 对冲请求沿用调用方在主请求上的设置
+        static void inherit(const brpc::Controller* from, brpc::Controller* to) {
+            if (from->has_log_id()) {
+                to->set_log_id(from->log_id());
+            }
+            to->set_request_compress_type(from->request_compress_type());
+            to->request_attachment().append(from->request_attachment());
+        }
+
+        // 对冲请求胜出: brpc不提供单独清除错误的接口，Reset后恢复调用方的设置，再取回对冲请求的应答附件
+        static void adopt(brpc::Controller* cntl, brpc::Controller* hedge) {
+            int32_t timeout_ms = cntl->timeout_ms();
+            int max_retry = cntl->max_retry();
+            bool has_log_id = cntl->has_log_id();
+            uint64_t log_id = cntl->log_id();
+            brpc::CompressType compress_type = cntl->request_compress_type();
+            butil::IOBuf request_attachment;
+            request_attachment.swap(cntl->request_attachment());
+            cntl->Reset();
+            cntl->set_timeout_ms(timeout_ms);
+            cntl->set_max_retry(max_retry);
+            if (has_log_id) {
+                cntl->set_log_id(log_id);
+            }
+            cntl->set_request_compress_type(compress_type);
+            cntl->request_attachment().swap(request_attachment);
+            cntl->response_attachment().swap(hedge->response_attachment());
+        }
+    };
+
+    template <typename Stub, typename Request, typename Response>
+    void ServiceChannel::call(void (Stub::*method)(google::protobuf::RpcController*, const Request*, Response*, google::protobuf::Closure*),
+        brpc::Controller* cntl, const Request* request, Response* response) {
+        auto primary = acquire();
+        if (!primary) {
+            cntl->SetFailed(EHOSTDOWN, "没有可用的%s节点", _service_name.c_str());
+            return;
+        }
+        if (!_hedge.enabled) {
+            Stub stub(primary.channel());
+            (stub.*method)(cntl, request, response, nullptr);
+            primary.release(cntl->Failed());
+            return;
+        }
+        refill_hedge_budget();
+        auto start = std::chrono::steady_clock::now();
+        HedgeCall state;
+        std::string primary_addr = primary.ip_port();
+        const brpc::CallId primary_id = cntl->call_id();
+        Stub primary_stub(primary.channel());
+        (primary_stub.*method)(cntl, request, response,
+            primary.wrap(google::protobuf::NewCallback(&HedgeCall::done, &state, cntl), cntl));
+
+        if (state.event.timed_wait(butil::microseconds_from_now(hedge_delay_us())) == 0
+            || state.winner.load() != nullptr) {
+            brpc::Join(primary_id);
+            return;
+        }
+        // 先为对冲请求预留计数再确认主请求仍未返回，否则主请求在两者之间失败返回时
+        // 会被当作最终结果，对冲请求发出后立即被取消
+        state.pending.fetch_add(1);
+        if (state.winner.load() != nullptr || !take_hedge_budget()) {
+            state.abandon(cntl);
+            brpc::Join(primary_id);
+            return;
+        }
+        auto backup = acquire_other(primary_addr);
+        if (!backup) {
+            state.abandon(cntl);
+            brpc::Join(primary_id);
+            return;
+        }
+        // 对冲请求与主请求共用截止时间
+        brpc::Controller hedge_cntl;
+        int64_t timeout_ms = cntl->timeout_ms() > 0 ? cntl->timeout_ms() : kDefaultTimeoutMs;
+        int64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (timeout_ms - elapsed_ms <= 0) {
+            state.abandon(cntl);
+            brpc::Join(primary_id);
+            return;
+        }
+        hedge_cntl.set_timeout_ms(timeout_ms - elapsed_ms);
+        HedgeCall::inherit(cntl, &hedge_cntl);
+        Response hedge_response;
+        std::string backup_addr = backup.ip_port();
+        const brpc::CallId hedge_id = hedge_cntl.call_id();
+        Stub hedge_stub(backup.channel());
+        (hedge_stub.*method)(&hedge_cntl, request, &hedge_response,
+            backup.wrap(google::protobuf::NewCallback(&HedgeCall::done, &state, &hedge_cntl), &hedge_cntl));
+
+        state.event.wait();
+        brpc::Controller* winner = state.winner.load();
+        brpc::StartCancel(winner == cntl ? hedge_id : primary_id);
+        brpc::Join(primary_id);
+        brpc::Join(hedge_id);
+        if (winner == &hedge_cntl && !hedge_cntl.Failed()) {
+            // 主请求已被取消，清除其错误状态，调用方按成功处理
+            LOG_DEBUG("{}对冲请求胜出: {} -> {}", _service_name, primary_addr, backup_addr);
+            HedgeCall::adopt(cntl, &hedge_cntl);
+            response->Swap(&hedge_response);
+        }
+    }
+
     class ServiceManager {
     public:
         using Ptr = std::shared_ptr<ServiceManager>;
 
+        // health_check_interval_ms: 主动健康检查的周期，<=0时不检查
+        // 默认1秒一次、连续2次失败即停止分配流量，早于etcd租约(默认3秒)过期发现崩溃的节点
+        explicit ServiceManager(int health_check_interval_ms = kHealthCheckIntervalMs) {
+            if (health_check_interval_ms > 0) {
+                _checker = std::thread(&ServiceManager::health_loop, this, health_check_interval_ms);
+            }
+        }
+
+        ~ServiceManager() {
+            if (_checker.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(_checker_mutex);
+                    _stop = true;
+                }
+                _checker_cond.notify_all();
+                _checker.join();
+            }
+        }
+
         // 获取指定服务的节点
         ChannelPtr get(const std::string& service_name) {
-            std::lock_guard<std::mutex> lock(_mutex);
-            auto it = _services.find(service_name);
-            if (it != _services.end()) {
-                return it->second->get();
+            auto channel = getServiceChannel(service_name);
+            if (channel) {
+                return channel->get();
+            }
+            else {
+                LOG_ERROR("没有能提供{}服务的节点", service_name);
+                return nullptr;
+            }
+        }
+
+        // 按affinity_key一致性哈希获取指定服务的节点
+        ChannelPtr get(const std::string& service_name, const std::string& affinity_key) {
+            auto channel = getServiceChannel(service_name);
+            if (channel) {
+                return channel->get(affinity_key);
             }
             else {
                 LOG_ERROR("没有能提供{}服务的节点", service_name);
@@ -178,10 +1127,45 @@ namespace blus {
             }
         }
 
-        // 声明关注的服务
-        void declare(const std::string& service_name) {
+        // 按服务声明的负载均衡策略租用节点，RPC完成后自动归还
+        ChannelLease lease(const std::string& service_name) {
+            auto channel = getServiceChannel(service_name);
+            if (!channel) {
+                LOG_ERROR("没有能提供{}服务的节点", service_name);
+                return ChannelLease();
+            }
+            return channel->acquire();
+        }
+
+        // 按affinity_key(如chat_session_id)做一致性哈希路由，同一key总是访问同一实例，便于利用实例本地缓存
+        ChannelLease lease(const std::string& service_name, const std::string& affinity_key) {
+            auto channel = getServiceChannel(service_name);
+            if (!channel) {
+                LOG_ERROR("没有能提供{}服务的节点", service_name);
+                return ChannelLease();
+            }
+            return channel->acquire(affinity_key);
+        }
+
+        // 声明关注的服务，并指定该服务使用的负载均衡策略与对冲配置
+        void declare(const std::string& service_name, LoadBalancePolicy policy = LoadBalancePolicy::LEAST_BUSY,
+            const HedgeOptions& hedge = HedgeOptions()) {
             std::lock_guard<std::mutex> lock(_mutex);
-            _focus.insert(service_name);
+            _focus[service_name] = ServiceOptions{ policy, hedge };
+        }
+
+        // 同步调用指定服务的RPC，服务声明时开启对冲则按对冲方式调用，结果由cntl给出
+        template <typename Stub, typename Request, typename Response>
+        void call(const std::string& service_name,
+            void (Stub::*method)(google::protobuf::RpcController*, const Request*, Response*, google::protobuf::Closure*),
+            brpc::Controller* cntl, const Request* request, Response* response) {
+            auto channel = getServiceChannel(service_name);
+            if (!channel) {
+                LOG_ERROR("没有能提供{}服务的节点", service_name);
+                cntl->SetFailed(EHOSTDOWN, "没有能提供%s服务的节点", service_name.c_str());
+                return;
+            }
+            channel->call(method, cntl, request, response);
         }
 
         // 取消关注的服务
@@ -192,35 +1176,35 @@ namespace blus {
 
         // 服务上线的回调函数
         void online(const std::string& service_instance, const std::string& ip_port) {
-            std::unique_lock<std::mutex> lock(_mutex);
+            std::lock_guard<std::mutex> lock(_mutex);
             auto service_name = getServiceName(service_instance);
-            if (_focus.find(service_name) == _focus.end()) {
+            auto focus = _focus.find(service_name);
+            if (focus == _focus.end()) {
                 LOG_DEBUG("添加服务节点时，服务{}未被关注", service_name);
                 return;
             }
-            auto it = _services.find(service_name);
-            if (it == _services.end()) {
-                auto channel = std::make_shared<ServiceChannel>(service_name);
-                channel->append(ip_port);
-                _services[service_name] = channel;
-                lock.unlock();
+            auto it = _channels.find(service_name);
+            if (it == _channels.end()) {
+                auto channel = std::make_shared<ServiceChannel>(service_name, focus->second.policy, focus->second.hedge);
+                channel->append(ip_port, true);
+                _channels[service_name] = channel;
+                publish();
             }
             else {
-                it->second->append(ip_port);
+                it->second->append(ip_port, true);
             }
         }
 
         // 服务下线的回调函数
         void offline(const std::string& service_instance, const std::string& ip_port) {
-            std::unique_lock<std::mutex> lock(_mutex);
+            std::lock_guard<std::mutex> lock(_mutex);
             auto service_name = getServiceName(service_instance);
             if (_focus.find(service_name) == _focus.end()) {
                 LOG_DEBUG("删除服务节点时，服务{}未被关注", service_name);
                 return;
             }
-            auto it = _services.find(service_name);
-            if (it != _services.end()) {
-                lock.unlock();
+            auto it = _channels.find(service_name);
+            if (it != _channels.end()) {
                 it->second->remove(ip_port);
             }
             else {
@@ -228,11 +1212,83 @@ namespace blus {
             }
         }
 
+        // 批量应用一次拓扑变更，元素为(服务实例, ip:port)
+        // 同一服务的上下线合并为一次信道变更，新出现的服务只发布一次服务表
+        void apply(const std::vector<std::pair<std::string, std::string>>& online,
+            const std::vector<std::pair<std::string, std::string>>& offline) {
+            struct Change {
+                std::vector<std::string> online;
+                std::vector<std::string> offline;
+            };
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::unordered_map<std::string, Change> changes;
+            for (const auto& [instance, ip_port] : offline) {
+                changes[getServiceName(instance)].offline.push_back(ip_port);
+            }
+            for (const auto& [instance, ip_port] : online) {
+                changes[getServiceName(instance)].online.push_back(ip_port);
+            }
+            bool created = false;
+            for (auto& [service_name, change] : changes) {
+                auto focus = _focus.find(service_name);
+                if (focus == _focus.end()) {
+                    LOG_DEBUG("变更服务节点时，服务{}未被关注", service_name);
+                    continue;
+                }
+                auto it = _channels.find(service_name);
+                if (it == _channels.end()) {
+                    if (change.online.empty()) {
+                        LOG_WARN("删除服务节点时，服务{}不存在", service_name);
+                        continue;
+                    }
+                    auto channel = std::make_shared<ServiceChannel>(service_name, focus->second.policy, focus->second.hedge);
+                    channel->apply(change.online, {}, true);
+                    _channels[service_name] = channel;
+                    created = true;
+                }
+                else {
+                    it->second->apply(change.online, change.offline, true);
+                }
+                _nodes_online << change.online.size();
+                _nodes_offline << change.offline.size();
+            }
+            if (created) {
+                publish();
+            }
+            _topology_updates << 1;
+        }
+
+        // 拓扑变更统计: 应用的批次数与累计上下线的节点数
+        struct TopologyStats {
+            int64_t updates;
+            int64_t online;
+            int64_t offline;
+        };
+        TopologyStats topology_stats() const {
+            return TopologyStats{ _topology_updates.get_value(), _nodes_online.get_value(), _nodes_offline.get_value() };
+        }
+
+        // 服务负载记录的回调函数，load_key形如 /load<service_name>/<instance>
+        void update_load(const std::string& load_key, const std::string& value) {
+            if (load_key.compare(0, 5, "/load") != 0) {
+                return;
+            }
+            auto channel = getServiceChannel(getServiceName(load_key.substr(5)));
+            LoadRecord record;
+            if (!channel || !LoadRecord::parse(value, record)) {
+                return;
+            }
+            channel->update_load(record);
+        }
+
         // 获取指定服务的信道管理对象
         ServiceChannel::Ptr getServiceChannel(const std::string& service_name) {
-            std::lock_guard<std::mutex> lock(_mutex);
-            auto it = _services.find(service_name);
-            if (it != _services.end()) {
+            ServiceMap::ScopedPtr services;
+            if (_services.Read(&services) != 0) {
+                return nullptr;
+            }
+            auto it = services->find(service_name);
+            if (it != services->end()) {
                 return it->second;
             }
             else {
@@ -240,6 +1296,12 @@ namespace blus {
             }
         }
     private:
+        struct ServiceOptions {
+            LoadBalancePolicy policy;
+            HedgeOptions hedge;
+        };
+        using ServiceMap = butil::DoublyBufferedData<std::unordered_map<std::string, ServiceChannel::Ptr>>;
+
         std::string getServiceName(const std::string& service_instance) {
             auto pos = service_instance.find_last_of('/');
             if (pos != std::string::npos) {
@@ -248,8 +1310,49 @@ namespace blus {
             return service_instance;
         }
 
-        std::mutex _mutex;
-        std::unordered_set<std::string> _focus; // 关注的服务
-        std::unordered_map<std::string, ServiceChannel::Ptr> _services;
+        // 后台线程: 周期性对所有服务的节点做健康探测，同一服务的节点并发探测
+        void health_loop(int interval_ms) {
+            std::unique_lock<std::mutex> lock(_checker_mutex);
+            while (!_checker_cond.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return _stop; })) {
+                lock.unlock();
+                std::vector<ServiceChannel::Ptr> channels;
+                {
+                    ServiceMap::ScopedPtr services;
+                    if (_services.Read(&services) == 0) {
+                        for (const auto& [_, channel] : *services) {
+                            channels.push_back(channel);
+                        }
+                    }
+                }
+                for (const auto& channel : channels) {
+                    channel->check_health();
+                }
+                lock.lock();
+            }
+        }
+
+        // 需在持有_mutex时调用，服务首次出现时发布新的服务表
+        void publish() {
+            auto update = [this](std::unordered_map<std::string, ServiceChannel::Ptr>& bg) {
+                bg = _channels;
+                return static_cast<size_t>(1);
+            };
+            _services.Modify(update);
+        }
+
+        std::mutex _mutex; // 仅保护写路径
+        std::unordered_map<std::string, ServiceOptions> _focus; // 关注的服务及其负载均衡策略、对冲配置
+        std::unordered_map<std::string, ServiceChannel::Ptr> _channels; // 写路径持有的服务表
+        ServiceMap _services; // 读路径使用的服务表快照
+        bvar::Adder<int64_t> _topology_updates{ "topology_updates" }; // 应用的拓扑变更批次数
+        bvar::Adder<int64_t> _nodes_online{ "topology_nodes_online" }; // 累计上线的节点数
+        bvar::Adder<int64_t> _nodes_offline{ "topology_nodes_offline" }; // 累计下线的节点数
+
+        static constexpr int kHealthCheckIntervalMs = 1000;
+
+        std::mutex _checker_mutex;
+        std::condition_variable _checker_cond;
+        bool _stop = false;
+        std::thread _checker; // 健康检查线程
     };
 }
@@ -3,8 +3,23 @@
 #include <memory>
 #include <cstdlib>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include <odb/mysql/database.hxx>
+#include <odb/mysql/connection.hxx>
+#include <odb/mysql/mysql.hxx>
 #include <odb/database.hxx>
+#include <odb/connection.hxx>
+#include <odb/transaction.hxx>
+#include <odb/prepared-query.hxx>
 
 #include "user.hxx"
 #include "user-odb.hxx"
@@ -12,9 +27,275 @@
 #include "chat_session_member-odb.hxx"
 #include "message.hxx"
 #include "message-odb.hxx"
+#include "message_archive.hpp"
+#include "shard.hpp"
 #include "logger.hpp"
 
 namespace blus {
+    // 主从读写路由: 写入及刚写过的键的读取走主库，其余读取走复制延迟最小的从库
+    // 后台线程定期查询各从库的复制延迟，延迟超过max_lag_sec或复制中断的从库不参与读取，
+    // 没有可用从库时读取回落到主库；未配置从库时等价于单库
+    // 读到自己的写入只覆盖本进程经wrote记录的写入: 其他实例刚提交的修改在复制延迟(至多max_lag_sec)内
+    // 仍可能从从库读到旧值，需要跨实例读到最新数据的场景(读-改-写、收到变更通知后的重新加载)应直接读主库
+    class DBRouter {
+    public:
+        using Ptr = std::shared_ptr<DBRouter>;
+        static constexpr int kMaxLagSec = 5;              // 可读从库允许的最大复制延迟
+        static constexpr int kReadYourWritesMs = 3000;    // 写入后该键的读取固定走主库的时长
+        static constexpr int kLagProbeIntervalMs = 1000;  // 复制延迟探测周期
+
+        DBRouter(const std::shared_ptr<odb::database>& primary,
+            const std::vector<std::shared_ptr<odb::mysql::database>>& replicas = {},
+            int max_lag_sec = kMaxLagSec,
+            int read_your_writes_ms = kReadYourWritesMs,
+            int probe_interval_ms = kLagProbeIntervalMs)
+            : _primary(primary)
+            , _replicas(replicas)
+            , _lags(replicas.size())
+            , _max_lag_sec(max_lag_sec)
+            , _ryw_window(std::chrono::milliseconds(read_your_writes_ms))
+            , _probe_interval(std::chrono::milliseconds(probe_interval_ms)) {
+            if (_replicas.empty()) return;
+            probe();
+            _probe_thread = std::thread([this]() { probe_loop(); });
+        }
+        ~DBRouter() {
+            {
+                std::lock_guard<std::mutex> lock(_probe_mutex);
+                _stop = true;
+            }
+            _probe_cv.notify_all();
+            if (_probe_thread.joinable()) _probe_thread.join();
+        }
+
+        const std::shared_ptr<odb::database>& primary() const { return _primary; }
+
+        // 选择读库: key最近被写过时走主库以保证读到自己的写入，key为空表示不要求
+        std::shared_ptr<odb::database> reader(const std::string& key = "") {
+            if (_replicas.empty() || (!key.empty() && recently_written(key))) {
+                return _primary;
+            }
+            // 在延迟与最小延迟相差不超过1秒的从库间轮询
+            long min_lag = -1;
+            for (const auto& lag : _lags) {
+                long l = lag.load(std::memory_order_relaxed);
+                if (l >= 0 && l <= _max_lag_sec && (min_lag < 0 || l < min_lag)) min_lag = l;
+            }
+            if (min_lag < 0) {
+                return _primary;
+            }
+            size_t n = _replicas.size();
+            size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = 0; i < n; ++i) {
+                size_t idx = (start + i) % n;
+                long l = _lags[idx].load(std::memory_order_relaxed);
+                if (l >= 0 && l <= min_lag + 1) {
+                    return _replicas[idx];
+                }
+            }
+            return _primary;
+        }
+
+        // 记录key刚被写入(在写事务提交后调用)
+        void wrote(const std::string& key) {
+            if (_replicas.empty() || key.empty()) return;
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            if (_written.size() >= kMaxTrackedKeys) {
+                for (auto it = _written.begin(); it != _written.end();) {
+                    if (now - it->second >= _ryw_window) it = _written.erase(it);
+                    else ++it;
+                }
+            }
+            _written[key] = now;
+        }
+
+        size_t replica_count() const { return _replicas.size(); }
+        // 各从库最近一次探测到的复制延迟(秒)，-1表示不可用
+        std::vector<long> replica_lags() const {
+            std::vector<long> lags;
+            for (const auto& lag : _lags) lags.push_back(lag.load(std::memory_order_relaxed));
+            return lags;
+        }
+
+    private:
+        static constexpr size_t kMaxTrackedKeys = 100000; // 超过后清理过期的写入记录
+
+        bool recently_written(const std::string& key) {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            auto it = _written.find(key);
+            if (it == _written.end()) return false;
+            if (std::chrono::steady_clock::now() - it->second < _ryw_window) return true;
+            _written.erase(it);
+            return false;
+        }
+
+        void probe_loop() {
+            std::unique_lock<std::mutex> lock(_probe_mutex);
+            while (!_probe_cv.wait_for(lock, _probe_interval, [this]() { return _stop; })) {
+                lock.unlock();
+                probe();
+                lock.lock();
+            }
+        }
+        void probe() {
+            for (size_t i = 0; i < _replicas.size(); ++i) {
+                long lag = replication_lag(*_replicas[i]);
+                long old = _lags[i].exchange(lag, std::memory_order_relaxed);
+                bool usable = lag >= 0 && lag <= _max_lag_sec;
+                bool was_usable = old >= 0 && old <= _max_lag_sec;
+                if (usable != was_usable) {
+                    if (usable) LOG_INFO("从库{}恢复可读, 复制延迟{}s", i, lag);
+                    else LOG_WARN("从库{}暂停读取, 复制延迟{}", i, lag < 0 ? std::string("未知") : std::to_string(lag) + "s");
+                }
+            }
+        }
+        // 查询从库的复制延迟(秒)，不是从库、复制中断或查询失败时返回-1
+        static long replication_lag(odb::mysql::database& db) {
+            try {
+                odb::mysql::connection_ptr conn(db.connection());
+                MYSQL* handle = conn->handle();
+                // MySQL 8.0.22起为SHOW REPLICA STATUS，旧版本只支持SHOW SLAVE STATUS
+                if (mysql_query(handle, "SHOW REPLICA STATUS") != 0 &&
+                    mysql_query(handle, "SHOW SLAVE STATUS") != 0) {
+                    return -1;
+                }
+                MYSQL_RES* res = mysql_store_result(handle);
+                if (res == nullptr) return -1;
+                long lag = -1;
+                MYSQL_ROW row = mysql_fetch_row(res);
+                if (row != nullptr) {
+                    unsigned int n = mysql_num_fields(res);
+                    MYSQL_FIELD* fields = mysql_fetch_fields(res);
+                    for (unsigned int i = 0; i < n; ++i) {
+                        std::string name = fields[i].name;
+                        if ((name == "Seconds_Behind_Source" || name == "Seconds_Behind_Master") && row[i] != nullptr) {
+                            lag = std::atol(row[i]);
+                        }
+                    }
+                }
+                mysql_free_result(res);
+                return lag;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("查询从库复制延迟失败: {}", e.what());
+                return -1;
+            }
+        }
+
+        std::shared_ptr<odb::database> _primary;
+        std::vector<std::shared_ptr<odb::mysql::database>> _replicas;
+        std::vector<std::atomic<long>> _lags;
+        std::atomic<size_t> _next{ 0 };
+        int _max_lag_sec;
+        std::chrono::steady_clock::duration _ryw_window;
+        std::chrono::steady_clock::duration _probe_interval;
+
+        std::mutex _write_mutex;
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> _written;
+
+        std::mutex _probe_mutex;
+        std::condition_variable _probe_cv;
+        bool _stop = false;
+        std::thread _probe_thread;
+    };
+
+    // 按chat_session_id把会话数据路由到分片，每个分片是一个DBRouter(主库及其从库)
+    // 映射表可在线更新为更高的版本，路由时读取当时生效的版本；各版本间相同地址的分片复用连接
+    class ShardRouter {
+    public:
+        using Ptr = std::shared_ptr<ShardRouter>;
+        using Factory = std::function<DBRouter::Ptr(const std::string& shard)>;
+
+        // 单库: 所有会话都在该库；factory为空时不能更新为引用其他地址的映射表
+        explicit ShardRouter(const DBRouter::Ptr& db, const Factory& factory = nullptr)
+            : _factory(factory), _home(db) {
+            _pool[kDefaultShard] = db;
+            auto state = std::make_shared<State>();
+            state->map = ShardMap::single(kDefaultShard);
+            state->dbs.push_back(db);
+            std::atomic_store(&_state, std::shared_ptr<const State>(state));
+        }
+
+        // 应用新的映射表，版本不高于当前版本或有分片无法连接时忽略
+        bool update(const ShardMap& map) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto current = std::atomic_load(&_state);
+            if (map.version <= current->map.version) {
+                LOG_WARN("忽略分片映射v{}, 当前已是v{}", map.version, current->map.version);
+                return false;
+            }
+            auto state = std::make_shared<State>();
+            state->map = map;
+            for (const auto& shard : map.shards) {
+                auto it = _pool.find(shard);
+                if (it == _pool.end()) {
+                    DBRouter::Ptr db = _factory ? _factory(shard) : nullptr;
+                    if (!db) {
+                        LOG_ERROR("分片映射v{}的分片{}无法连接", map.version, shard);
+                        return false;
+                    }
+                    it = _pool.emplace(shard, db).first;
+                }
+                state->dbs.push_back(it->second);
+            }
+            std::atomic_store(&_state, std::shared_ptr<const State>(state));
+            LOG_INFO("分片映射更新到v{}, 共{}个分片", map.version, map.shards.size());
+            return true;
+        }
+        bool update(const std::string& json) {
+            ShardMap map;
+            return ShardMap::parse(json, map) && update(map);
+        }
+
+        int64_t version() const {
+            return std::atomic_load(&_state)->map.version;
+        }
+        // 会话读取所在分片: 迁移中的槽读源分片
+        DBRouter::Ptr read_shard(const std::string& session_id) const {
+            auto state = std::atomic_load(&_state);
+            int slot = ShardMap::slot_of(session_id);
+            int moving = state->map.moving_from[slot];
+            return state->dbs[moving >= 0 ? moving : state->map.owner[slot]];
+        }
+        // 会话写入的分片: 迁移中的槽同时写目标和源分片
+        std::vector<DBRouter::Ptr> write_shards(const std::string& session_id) const {
+            auto state = std::atomic_load(&_state);
+            int slot = ShardMap::slot_of(session_id);
+            std::vector<DBRouter::Ptr> shards{ state->dbs[state->map.owner[slot]] };
+            if (state->map.moving_from[slot] >= 0) {
+                shards.push_back(state->dbs[state->map.moving_from[slot]]);
+            }
+            return shards;
+        }
+        // 默认分片(构造时的库)，保存不按会话分片的全局数据
+        const DBRouter::Ptr& home() const { return _home; }
+        // 当前映射表引用的所有分片，用于无会话条件的查询和维护
+        std::vector<DBRouter::Ptr> all() const {
+            auto state = std::atomic_load(&_state);
+            std::vector<DBRouter::Ptr> shards;
+            for (const auto& db : state->dbs) {
+                if (std::find(shards.begin(), shards.end(), db) == shards.end()) {
+                    shards.push_back(db);
+                }
+            }
+            return shards;
+        }
+
+    private:
+        static constexpr const char* kDefaultShard = "default";
+        struct State {
+            ShardMap map;
+            std::vector<DBRouter::Ptr> dbs; // 与map.shards一一对应
+        };
+
+        Factory _factory;
+        DBRouter::Ptr _home;
+        std::mutex _mutex; // 串行化更新
+        std::unordered_map<std::string, DBRouter::Ptr> _pool;
+        std::shared_ptr<const State> _state;
+    };
+
     class ODBFactory {
     public:
         static std::shared_ptr<odb::core::database> create(
@@ -26,6 +307,68 @@ namespace blus {
             int conn_pool_count = 10,
             int port = 3306,
             const std::string& cset = "utf8") {
+            return create_mysql(user, pswd, db, host, sock_path, conn_pool_count, port, cset);
+        }
+        // 主库加从库: replicas为逗号分隔的host:port列表(省略端口时沿用主库端口)，为空时只有主库
+        static DBRouter::Ptr create_router(
+            const std::string& user,
+            const std::string& pswd,
+            const std::string& db,
+            const std::string& host,
+            const std::string& sock_path = "",
+            int conn_pool_count = 10,
+            int port = 3306,
+            const std::string& cset = "utf8",
+            const std::string& replicas = "") {
+            auto primary = create_mysql(user, pswd, db, host, sock_path, conn_pool_count, port, cset);
+            std::vector<std::shared_ptr<odb::mysql::database>> replica_dbs;
+            size_t begin = 0;
+            while (begin < replicas.size()) {
+                size_t end = replicas.find(',', begin);
+                if (end == std::string::npos) end = replicas.size();
+                std::string addr = replicas.substr(begin, end - begin);
+                begin = end + 1;
+                if (addr.empty()) continue;
+                std::string replica_host = addr;
+                int replica_port = port;
+                auto colon = addr.rfind(':');
+                if (colon != std::string::npos) {
+                    replica_host = addr.substr(0, colon);
+                    replica_port = std::atoi(addr.c_str() + colon + 1);
+                }
+                replica_dbs.push_back(create_mysql(user, pswd, db, replica_host, "", conn_pool_count, replica_port, cset));
+            }
+            return std::make_shared<DBRouter>(primary, replica_dbs);
+        }
+        // 会话分片: 初始只有参数配置的库("default")，映射表中的其他分片地址(host:port)按需以相同账号连接
+        static ShardRouter::Ptr create_shards(
+            const std::string& user,
+            const std::string& pswd,
+            const std::string& db,
+            const std::string& host,
+            const std::string& sock_path = "",
+            int conn_pool_count = 10,
+            int port = 3306,
+            const std::string& cset = "utf8",
+            const std::string& replicas = "") {
+            auto primary = create_router(user, pswd, db, host, sock_path, conn_pool_count, port, cset, replicas);
+            return std::make_shared<ShardRouter>(primary, [=](const std::string& shard) {
+                auto colon = shard.rfind(':');
+                std::string shard_host = shard.substr(0, colon);
+                int shard_port = colon == std::string::npos ? port : std::atoi(shard.c_str() + colon + 1);
+                return create_router(user, pswd, db, shard_host, "", conn_pool_count, shard_port, cset);
+                });
+        }
+    private:
+        static std::shared_ptr<odb::mysql::database> create_mysql(
+            const std::string& user,
+            const std::string& pswd,
+            const std::string& db,
+            const std::string& host,
+            const std::string& sock_path,
+            int conn_pool_count,
+            int port,
+            const std::string& cset) {
             std::unique_ptr<odb::mysql::connection_pool_factory> cpf(
                 new odb::mysql::connection_pool_factory(conn_pool_count, 0));
             return std::make_shared<odb::mysql::database>(user, pswd,
@@ -33,17 +376,40 @@ namespace blus {
         }
     };
 
+    // 预编译查询的绑定参数: 查询条件通过query::_ref引用其中的字段，执行前写入即可
+    struct KeyParam {
+        std::string key;
+    };
+
+    // 取当前事务所在连接上缓存的预编译查询，该连接首次执行时才生成并缓存
+    // 连接池中的连接长期存活，之后的调用只绑定参数执行，省去每次拼接、解析和规划SQL
+    // make_query(KeyParam&)返回以_ref引用参数字段的查询条件
+    template <typename T, typename MakeQuery>
+    odb::prepared_query<T> cached_query(const char* name, KeyParam*& param, MakeQuery make_query) {
+        odb::connection& conn(odb::transaction::current().connection());
+        odb::prepared_query<T> pq(conn.lookup_query<T>(name, param));
+        if (!pq) {
+            std::unique_ptr<KeyParam> p(new KeyParam);
+            param = p.get();
+            pq = conn.prepare_query<T>(name, make_query(*p));
+            conn.cache_query(pq, std::move(p));
+        }
+        return pq;
+    }
+
     class UserTable {
     public:
         using Ptr = std::shared_ptr<UserTable>;
         UserTable() {}
-        UserTable(const std::shared_ptr<odb::database>& db) : _db(db) {}
+        UserTable(const std::shared_ptr<odb::database>& db) : UserTable(std::make_shared<DBRouter>(db)) {}
+        UserTable(const DBRouter::Ptr& router) : _db(router->primary()), _router(router) {}
 
         bool insert(const std::shared_ptr<User>& user) {
             try {
                 odb::transaction trans(_db->begin());
                 _db->persist(*user);
                 trans.commit();
+                mark_written(*user);
                 return true;
             }
             catch (const std::exception& e) {
@@ -60,6 +426,7 @@ namespace blus {
                 odb::transaction trans(_db->begin());
                 _db->update(*user);
                 trans.commit();
+                mark_written(*user);
                 return true;
             }
             catch (const std::exception& e) {
@@ -78,6 +445,7 @@ namespace blus {
                 // 使用 erase_query 删除满足条件的记录
                 auto count = _db->erase_query<User>(query::user_id == user_id);
                 trans.commit();
+                _router->wrote(user_id);
                 return (count > 0);
             }
             catch (const std::exception& e) {
@@ -99,95 +467,157 @@ namespace blus {
             }
         }
         std::shared_ptr<User> select_by_uid(const std::string& user_id) {
+            return select_by_uid(*_router->reader(user_id), user_id);
+        }
+        // 从主库读取(不加行锁)，用于读-改-写及需要看到其他实例刚提交的修改的场景
+        // 避免以落后的从库数据整行覆盖；并发修改同一用户时仍以后提交的一次为准
+        std::shared_ptr<User> select_by_uid_primary(const std::string& user_id) {
+            return select_by_uid(*_db, user_id);
+        }
+        std::shared_ptr<User> select_by_nickname(const std::string& nickname) {
             std::shared_ptr<User> res;
             try {
-                odb::transaction trans(_db->begin());
+                odb::transaction trans(_router->reader(nickname)->begin());
                 using query = odb::query<User>;
-                using result = odb::result<User>;
-                res.reset(_db->query_one<User>(query::user_id == user_id));
+                KeyParam* param = nullptr;
+                auto pq = cached_query<User>("user_by_nickname", param, [](KeyParam& p) {
+                    return query(query::nickname == query::_ref(p.key));
+                    });
+                param->key = nickname;
+                res.reset(pq.execute_one());
                 trans.commit();
                 return res;
             }
             catch (const std::exception& e) {
-                LOG_ERROR("查询用户失败 user_id: {}, {}", user_id, e.what());
+                LOG_ERROR("查询用户失败 nickname: {}, {}", nickname, e.what());
             }
             return nullptr;
         }
-        std::shared_ptr<User> select_by_nickname(const std::string& nickname) {
+        std::shared_ptr<User> select_by_email(const std::string& email) {
             std::shared_ptr<User> res;
             try {
-                odb::transaction trans(_db->begin());
+                odb::transaction trans(_router->reader(email)->begin());
                 using query = odb::query<User>;
-                using result = odb::result<User>;
-                res.reset(_db->query_one<User>(query::nickname == nickname));
+                KeyParam* param = nullptr;
+                auto pq = cached_query<User>("user_by_email", param, [](KeyParam& p) {
+                    return query(query::email == query::_ref(p.key));
+                    });
+                param->key = email;
+                res.reset(pq.execute_one());
                 trans.commit();
                 return res;
             }
             catch (const std::exception& e) {
-                LOG_ERROR("查询用户失败 nickname: {}, {}", nickname, e.what());
+                LOG_ERROR("查询用户失败 email: {}, {}", email, e.what());
             }
             return nullptr;
         }
-        std::shared_ptr<User> select_by_email(const std::string& email) {
-            std::shared_ptr<User> res;
+        // 批量查询用户，结果以user_id为键，不存在的用户不出现在结果中；查询失败返回false
+        // ID去重后按kChunkSize切块，每块以绑定参数的IN(?,...)查询(走user_id唯一索引)，
+        // 各块在同一个事务(一条连接)上依次执行
+        bool select_users(const std::vector<std::string>& user_ids, std::unordered_map<std::string, std::shared_ptr<User>>& users) {
+            std::vector<std::string> ids;
+            std::unordered_set<std::string> seen;
+            for (const auto& id : user_ids) {
+                if (seen.insert(id).second) {
+                    ids.push_back(id);
+                }
+            }
+            users.clear();
+            if (ids.empty()) {
+                return true;
+            }
+            // 批量查询不要求读到自己的写入，整批走同一个读库
+            auto db = _router->reader();
             try {
-                odb::transaction trans(_db->begin());
+                odb::transaction trans(db->begin());
                 using query = odb::query<User>;
                 using result = odb::result<User>;
-                res.reset(_db->query_one<User>(query::email == email));
+                for (size_t begin = 0; begin < ids.size(); begin += kChunkSize) {
+                    auto first = ids.begin() + begin;
+                    auto last = ids.begin() + std::min(ids.size(), begin + kChunkSize);
+                    result r(db->query<User>(query::user_id.in_range(first, last)));
+                    for (const auto& user : r) {
+                        users.emplace(user.user_id(), std::make_shared<User>(user));
+                    }
+                }
                 trans.commit();
-                return res;
+                return true;
             }
             catch (const std::exception& e) {
-                LOG_ERROR("查询用户失败 email: {}, {}", email, e.what());
+                LOG_ERROR("批量查询用户失败 首个user_id: {}, 共{}个, {}", ids.front(), ids.size(), e.what());
+                users.clear();
+                return false;
             }
-            return nullptr;
         }
         std::vector<std::shared_ptr<User>> select_multi_users(const std::vector<std::string>& user_ids) {
+            std::unordered_map<std::string, std::shared_ptr<User>> found;
+            std::vector<std::shared_ptr<User>> users;
+            if (!select_users(user_ids, found)) {
+                return users;
+            }
+            for (auto& [_, user] : found) {
+                users.push_back(std::move(user));
+            }
+            return users;
+        }
+    private:
+        static constexpr size_t kChunkSize = 100; // 单条查询的最大ID数
+
+        std::shared_ptr<User> select_by_uid(odb::database& db, const std::string& user_id) {
+            std::shared_ptr<User> res;
             try {
-                odb::transaction trans(_db->begin());
+                odb::transaction trans(db.begin());
                 using query = odb::query<User>;
-                using result = odb::result<User>;
-                std::string condition;
-                condition += "user_id in (";
-                for (const auto& id : user_ids) {
-                    condition += "'" + id + "',";
-                }
-                condition.pop_back();
-                condition += ")";
-
-                result r = _db->query<User>(condition);
-                std::vector<std::shared_ptr<User>> users;
-                for (const auto& user : r) {
-                    users.push_back(std::make_shared<User>(user));
-                }
+                KeyParam* param = nullptr;
+                auto pq = cached_query<User>("user_by_user_id", param, [](KeyParam& p) {
+                    return query(query::user_id == query::_ref(p.key));
+                    });
+                param->key = user_id;
+                res.reset(pq.execute_one());
                 trans.commit();
-                return users;
+                return res;
             }
             catch (const std::exception& e) {
-                std::string ids;
-                for (const auto& id : user_ids) {
-                    ids += id + ",";
-                }
-                ids.pop_back();
-                LOG_ERROR("查询多用户失败 user_ids: {}, {}", ids, e.what());
+                LOG_ERROR("查询用户失败 user_id: {}, {}", user_id, e.what());
             }
-            return std::vector<std::shared_ptr<User>>();
+            return nullptr;
         }
-    private:
+        // 写入后用户ID、昵称、邮箱的读取在一段时间内走主库
+        void mark_written(const User& user) {
+            _router->wrote(user.user_id());
+            _router->wrote(user.nickname());
+            _router->wrote(user.email());
+        }
+
         std::shared_ptr<odb::database> _db;
+        DBRouter::Ptr _router;
     };
 
     class ChatSessionMemberTable {
     public:
         using Ptr = std::shared_ptr<ChatSessionMemberTable>;
-        ChatSessionMemberTable(const std::shared_ptr<odb::database>& db) : _db(db) {}
+        ChatSessionMemberTable(const std::shared_ptr<odb::database>& db) : ChatSessionMemberTable(std::make_shared<DBRouter>(db)) {}
+        ChatSessionMemberTable(const DBRouter::Ptr& router) : ChatSessionMemberTable(std::make_shared<ShardRouter>(router)) {}
+        ChatSessionMemberTable(const ShardRouter::Ptr& shards) : _shards(shards) {}
+
+        // 成员变更通知(参数为会话ID)，用于失效各实例的成员缓存
+        // 写入失败时也会通知: 多分片写入可能已部分生效，多一次失效无害
+        using ChangeCallback = std::function<void(const std::string&)>;
+        void on_change(const ChangeCallback& cb) {
+            _on_change = cb;
+        }
 
         bool append(const std::shared_ptr<ChatSessionMember>& member) {
+            ChangeNotifier notify(this, member->session_id());
             try {
-                odb::transaction trans(_db->begin());
-                _db->persist(*member);
-                trans.commit();
+                for (const auto& shard : _shards->write_shards(member->session_id())) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    db.persist(*member);
+                    trans.commit();
+                    shard->wrote(member->session_id());
+                }
                 return true;
             }
             catch (const std::exception& e) {
@@ -203,12 +633,30 @@ namespace blus {
             if (members.empty()) {
                 return false;
             }
+            std::unordered_set<std::string> sessions;
+            for (const auto& member : members) {
+                sessions.insert(member->session_id());
+            }
+            ChangeNotifier notify(this, std::vector<std::string>(sessions.begin(), sessions.end()));
+            // 按分片分组，每个分片一个事务
+            std::unordered_map<DBRouter::Ptr, std::vector<std::shared_ptr<ChatSessionMember>>> groups;
+            for (const auto& member : members) {
+                for (const auto& shard : _shards->write_shards(member->session_id())) {
+                    groups[shard].push_back(member);
+                }
+            }
             try {
-                odb::transaction trans(_db->begin());
-                for (const auto& member : members) {
-                    _db->persist(*member);
+                for (const auto& [shard, group] : groups) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    for (const auto& member : group) {
+                        db.persist(*member);
+                    }
+                    trans.commit();
+                    for (const auto& member : group) {
+                        shard->wrote(member->session_id());
+                    }
                 }
-                trans.commit();
                 return true;
             }
             catch (const std::exception& e) {
@@ -228,11 +676,17 @@ namespace blus {
             return append(ptrs);
         }
         bool remove(const ChatSessionMember& member) {
+            ChangeNotifier notify(this, member.session_id());
             try {
-                odb::transaction trans(_db->begin());
-                using query = odb::query<ChatSessionMember>;
-                auto count = _db->erase_query<ChatSessionMember>(query::session_id == member.session_id() && query::user_id == member.user_id());
-                trans.commit();
+                unsigned long long count = 0;
+                for (const auto& shard : _shards->write_shards(member.session_id())) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    using query = odb::query<ChatSessionMember>;
+                    count += db.erase_query<ChatSessionMember>(query::session_id == member.session_id() && query::user_id == member.user_id());
+                    trans.commit();
+                    shard->wrote(member.session_id());
+                }
                 return (count > 0);
             }
             catch (const std::exception& e) {
@@ -241,11 +695,16 @@ namespace blus {
             }
         }
         bool remove(const std::string& session_id) {
+            ChangeNotifier notify(this, session_id);
             try {
-                odb::transaction trans(_db->begin());
-                using query = odb::query<ChatSessionMember>;
-                _db->erase_query<ChatSessionMember>(query::session_id == session_id);
-                trans.commit();
+                for (const auto& shard : _shards->write_shards(session_id)) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    using query = odb::query<ChatSessionMember>;
+                    db.erase_query<ChatSessionMember>(query::session_id == session_id);
+                    trans.commit();
+                    shard->wrote(session_id);
+                }
                 return true;
             }
             catch (const std::exception& e) {
@@ -255,10 +714,13 @@ namespace blus {
         }
         bool clear() {
             try {
-                odb::transaction trans(_db->begin());
-                // 直接执行 SQL TRUNCATE，相当于清空整个表
-                _db->execute("TRUNCATE TABLE chat_session_member");
-                trans.commit();
+                for (const auto& shard : _shards->all()) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    // 直接执行 SQL TRUNCATE，相当于清空整个表
+                    db.execute("TRUNCATE TABLE chat_session_member");
+                    trans.commit();
+                }
                 return true;
             }
             catch (const std::exception& e) {
@@ -269,12 +731,15 @@ namespace blus {
         std::vector<std::string> get_members(const std::string& session_id) {
             std::vector<std::string> members;
             try {
-                odb::transaction trans(_db->begin());
+                odb::transaction trans(_shards->read_shard(session_id)->reader(session_id)->begin());
                 using query = odb::query<ChatSessionMember>;
                 using result = odb::result<ChatSessionMember>;
-
-                result r = _db->query<ChatSessionMember>(query::session_id == session_id);
-                std::vector<std::shared_ptr<User>> users;
+                KeyParam* param = nullptr;
+                auto pq = cached_query<ChatSessionMember>("members_by_session", param, [](KeyParam& p) {
+                    return query(query::session_id == query::_ref(p.key));
+                    });
+                param->key = session_id;
+                result r(pq.execute());
                 for (const auto& member : r) {
                     members.push_back(member.user_id());
                 }
@@ -286,20 +751,87 @@ namespace blus {
             return members;
         }
     private:
-        std::shared_ptr<odb::database> _db;
+        // 离开作用域(写入完成或失败)时发出变更通知
+        struct ChangeNotifier {
+            ChatSessionMemberTable* table;
+            std::vector<std::string> sessions;
+            ChangeNotifier(ChatSessionMemberTable* t, const std::string& session_id) : table(t), sessions{ session_id } {}
+            ChangeNotifier(ChatSessionMemberTable* t, std::vector<std::string> ids) : table(t), sessions(std::move(ids)) {}
+            ~ChangeNotifier() {
+                if (!table->_on_change) return;
+                for (const auto& session_id : sessions) {
+                    table->_on_change(session_id);
+                }
+            }
+        };
+
+        ShardRouter::Ptr _shards;
+        ChangeCallback _on_change;
+    };
+
+    // 消息分页游标: 上一页最早一条消息的(create_time, _id)，下一页从其之前继续
+    // 对客户端是不透明的字符串 "<创建时间的epoch微秒>-<_id>"
+    struct MessageCursor {
+        boost::posix_time::ptime create_time;
+        unsigned long id = 0;
+
+        std::string encode() const {
+            static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            return std::to_string((create_time - epoch).total_microseconds()) + "-" + std::to_string(id);
+        }
+
+        static bool decode(const std::string& token, MessageCursor& cursor) {
+            static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            auto pos = token.find('-');
+            if (pos == std::string::npos || pos == 0 || pos + 1 == token.size()) {
+                return false;
+            }
+            try {
+                size_t used = 0;
+                long long micros = std::stoll(token.substr(0, pos), &used);
+                if (used != pos) {
+                    return false;
+                }
+                unsigned long id = std::stoul(token.substr(pos + 1), &used);
+                if (used != token.size() - pos - 1) {
+                    return false;
+                }
+                cursor.create_time = epoch + boost::posix_time::microseconds(micros);
+                cursor.id = id;
+                return true;
+            }
+            catch (const std::exception&) {
+                return false;
+            }
+        }
 
+        // 以时间点为游标: 取该时间之前的消息
+        static MessageCursor before(boost::posix_time::ptime time) {
+            return MessageCursor{ time, 0 };
+        }
     };
 
     class MessageTable {
     public:
         using Ptr = std::shared_ptr<MessageTable>;
-        MessageTable(const std::shared_ptr<odb::database>& db) : _db(db) {}
+        static constexpr int kMaxPageSize = 200; // 单页最多返回的消息数
+
+        MessageTable(const std::shared_ptr<odb::database>& db) : MessageTable(std::make_shared<DBRouter>(db)) {}
+        // archive非空时早于归档水位的消息从归档读取，热表只查询水位之后的消息
+        MessageTable(const DBRouter::Ptr& router, const MessageArchive::Ptr& archive = nullptr)
+            : MessageTable(std::make_shared<ShardRouter>(router), archive) {}
+        MessageTable(const ShardRouter::Ptr& shards, const MessageArchive::Ptr& archive = nullptr)
+            : _shards(shards), _archive(archive) {}
 
         bool insert(const std::shared_ptr<Message>& message) {
             try {
-                odb::transaction trans(_db->begin());
-                _db->persist(*message);
-                trans.commit();
+                for (const auto& shard : _shards->write_shards(message->session_id())) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    db.persist(*message);
+                    trans.commit();
+                    shard->wrote(message->session_id());
+                }
                 return true;
             }
             catch (const std::exception& e) {
@@ -311,12 +843,32 @@ namespace blus {
             auto message_ptr = std::make_shared<Message>(message);
             return insert(message_ptr);
         }
+        // 批量插入: 按分片分组，每个分片一个事务内以多行INSERT写入，每kMaxBatchRows行一条语句
+        // 同一分片内任一失败整体回滚；不同分片的事务相互独立，失败时其他分片可能已提交
+        bool insert(const std::vector<Message>& messages) {
+            if (messages.empty()) return true;
+            std::unordered_map<DBRouter::Ptr, std::vector<Message>> groups;
+            for (const auto& m : messages) {
+                for (const auto& shard : _shards->write_shards(m.session_id())) {
+                    groups[shard].push_back(m);
+                }
+            }
+            bool ok = true;
+            for (const auto& [shard, group] : groups) {
+                ok = insert_batch(*shard, group) && ok;
+            }
+            return ok;
+        }
         bool remove(const std::string& session_id) {
             try {
-                odb::transaction trans(_db->begin());
-                using query = odb::query<Message>;
-                _db->erase_query<Message>(query::session_id == session_id);
-                trans.commit();
+                for (const auto& shard : _shards->write_shards(session_id)) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    using query = odb::query<Message>;
+                    db.erase_query<Message>(query::session_id == session_id);
+                    trans.commit();
+                    shard->wrote(session_id);
+                }
                 return true;
             }
             catch (const std::exception& e) {
@@ -326,9 +878,16 @@ namespace blus {
         }
         bool clear() {
             try {
-                odb::transaction trans(_db->begin());
-                // 直接执行 SQL TRUNCATE，相当于清空整个表
-                _db->execute("TRUNCATE TABLE message");
+                for (const auto& shard : _shards->all()) {
+                    auto& db = *shard->primary();
+                    odb::transaction trans(db.begin());
+                    // 直接执行 SQL TRUNCATE，相当于清空整个表
+                    db.execute("TRUNCATE TABLE message");
+                    trans.commit();
+                }
+                auto& db = *_shards->home()->primary();
+                odb::transaction trans(db.begin());
+                db.execute("TRUNCATE TABLE message_archive_state");
                 trans.commit();
                 return true;
             }
@@ -337,15 +896,22 @@ namespace blus {
                 return false;
             }
         }
+        // message_id不含会话信息，需要依次查询各分片
         std::shared_ptr<Message> select_by_mid(const std::string& message_id) {
             std::shared_ptr<Message> res;
             try {
-                odb::transaction trans(_db->begin());
-                using query = odb::query<Message>;
-                using result = odb::result<Message>;
-                res.reset(_db->query_one<Message>(query::message_id == message_id));
-                trans.commit();
-                return res;
+                for (const auto& shard : _shards->all()) {
+                    odb::transaction trans(shard->reader()->begin());
+                    using query = odb::query<Message>;
+                    KeyParam* param = nullptr;
+                    auto pq = cached_query<Message>("message_by_mid", param, [](KeyParam& p) {
+                        return query(query::message_id == query::_ref(p.key));
+                        });
+                    param->key = message_id;
+                    res.reset(pq.execute_one());
+                    trans.commit();
+                    if (res) return res;
+                }
             }
             catch (const std::exception& e) {
                 LOG_ERROR("查询消息失败 message_id: {}, {}", message_id, e.what());
@@ -353,16 +919,35 @@ namespace blus {
             return nullptr;
         }
         std::vector<Message> get_recent(const std::string& session_id, int count) {
+            std::string next_cursor;
+            return get_page(session_id, nullptr, count, next_cursor);
+        }
+        // keyset分页: 取游标(不含)之前最近的count条消息，按时间正序返回；before为空时从最新消息开始
+        // 沿(session_id, create_time, _id)索引定位后顺序扫描count+1行，翻到多深都不需要跳过前面的行
+        // 还有更早的消息时next_cursor为下一页的游标，否则为空
+        std::vector<Message> get_page(const std::string& session_id, const MessageCursor* before, int count,
+            std::string& next_cursor) {
             std::vector<Message> messages;
+            next_cursor.clear();
+            count = std::max(1, std::min(count, kMaxPageSize));
+            auto horizon = hot_horizon();
             try {
-                odb::transaction trans(_db->begin());
+                auto db = _shards->read_shard(session_id)->reader(session_id);
+                odb::transaction trans(db->begin());
                 using query = odb::query<Message>;
                 using result = odb::result<Message>;
 
-                // ssid为条件, 时间逆序, limit为条数
-                std::stringstream cond;
-                cond << "session_id = '" << session_id << "' ORDER BY create_time DESC LIMIT " << count;
-                result r = _db->query<Message>(cond.str());
+                query q(query::session_id == session_id);
+                if (_archive) {
+                    q = q && query::create_time >= horizon;
+                }
+                if (before) {
+                    // 行构造器比较可直接用作复合索引的范围条件
+                    q += "AND (" + query::create_time + "," + query::id + ") < ("
+                        + query::_val(before->create_time) + "," + query::_val(before->id) + ")";
+                }
+                q += "ORDER BY" + query::create_time + "DESC," + query::id + "DESC LIMIT" + query::_val(count + 1);
+                result r(db->query<Message>(q));
                 for (const auto& message : r) {
                     messages.push_back(message);
                 }
@@ -370,20 +955,96 @@ namespace blus {
             }
             catch (const std::exception& e) {
                 LOG_ERROR("查询会话消息失败{}: {}", session_id, e.what());
+                return {};
+            }
+            // 热表中的消息不够一页时从归档中水位之前的部分接着取
+            if (_archive && static_cast<int>(messages.size()) <= count) {
+                MessageCursor from = MessageCursor::before(horizon);
+                if (before && before->create_time < horizon) {
+                    from = *before;
+                }
+                auto archived = _archive->read_before(session_id, from.create_time, from.id, count + 1 - messages.size());
+                messages.insert(messages.end(), archived.rbegin(), archived.rend());
+            }
+            if (static_cast<int>(messages.size()) > count) {
+                messages.pop_back();
+                next_cursor = MessageCursor{ messages.back().create_time(), messages.back().id() }.encode();
             }
             // 反转消息顺序
             std::reverse(messages.begin(), messages.end());
             return messages;
         }
+        // 时间区间内按时间正序分页: 取游标(不含)之后的最多count条，after为空时从start开始
+        // 还有更多消息时next_cursor为本页最后一条的游标，否则为空
+        std::vector<Message> get_range_page(const std::string& session_id, boost::posix_time::ptime start,
+            boost::posix_time::ptime end, const MessageCursor* after, int count, std::string& next_cursor) {
+            std::vector<Message> messages;
+            next_cursor.clear();
+            count = std::max(1, std::min(count, kMaxPageSize));
+            auto horizon = hot_horizon();
+            // 起点在水位之前时先从归档取，不够一页再接着查热表
+            if (_archive && (after ? after->create_time : start) < horizon) {
+                MessageCursor from = after ? *after : MessageCursor{ start, 0 };
+                messages = _archive->read_after(session_id, from.create_time, from.id, end, count + 1);
+                if (static_cast<int>(messages.size()) > count) {
+                    messages.pop_back();
+                    next_cursor = MessageCursor{ messages.back().create_time(), messages.back().id() }.encode();
+                    return messages;
+                }
+            }
+            try {
+                auto db = _shards->read_shard(session_id)->reader(session_id);
+                odb::transaction trans(db->begin());
+                using query = odb::query<Message>;
+                using result = odb::result<Message>;
+
+                query q(query::session_id == session_id && query::create_time >= start && query::create_time <= end);
+                if (_archive) {
+                    q = q && query::create_time >= horizon;
+                }
+                if (after) {
+                    q += "AND (" + query::create_time + "," + query::id + ") > ("
+                        + query::_val(after->create_time) + "," + query::_val(after->id) + ")";
+                }
+                q += "ORDER BY" + query::create_time + "ASC," + query::id + "ASC LIMIT"
+                    + query::_val(count + 1 - static_cast<int>(messages.size()));
+                result r(db->query<Message>(q));
+                for (const auto& message : r) {
+                    messages.push_back(message);
+                }
+                trans.commit();
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("分页查询会话区间消息失败{} {} to {}: {}", session_id,
+                    boost::posix_time::to_simple_string(start),
+                    boost::posix_time::to_simple_string(end), e.what());
+                return {};
+            }
+            if (static_cast<int>(messages.size()) > count) {
+                messages.pop_back();
+                next_cursor = MessageCursor{ messages.back().create_time(), messages.back().id() }.encode();
+            }
+            return messages;
+        }
+        // 注意: 不限制条数，仅用于已知范围很小的场景，对外接口应使用get_range_page
         std::vector<Message> get_range(const std::string& session_id, boost::posix_time::ptime start, boost::posix_time::ptime end) {
             std::vector<Message> messages;
+            auto horizon = hot_horizon();
+            if (_archive && start < horizon) {
+                messages = _archive->read(session_id, start, end);
+            }
             try {
-                odb::transaction trans(_db->begin());
+                auto db = _shards->read_shard(session_id)->reader(session_id);
+                odb::transaction trans(db->begin());
                 using query = odb::query<Message>;
                 using result = odb::result<Message>;
 
                 // ssid为条件, 时间过滤
-                result r = _db->query<Message>(query::session_id == session_id && query::create_time >= start && query::create_time <= end);
+                query q(query::session_id == session_id && query::create_time >= start && query::create_time <= end);
+                if (_archive) {
+                    q = q && query::create_time >= horizon;
+                }
+                result r = db->query<Message>(q);
                 for (const auto& message : r) {
                     messages.push_back(message);
                 }
@@ -396,7 +1057,298 @@ namespace blus {
             }
             return messages;
         }
+
+        // 所有实例共用的归档水位，未归档过时为min_date_time
+        bool shared_horizon(boost::posix_time::ptime& horizon) const {
+            auto& db = *_shards->home()->primary();
+            try {
+                odb::transaction trans(db.begin());
+                std::unique_ptr<MessageArchiveState> state(db.find<MessageArchiveState>(MessageArchiveState::kId));
+                trans.commit();
+                horizon = state ? state->horizon() : boost::posix_time::ptime(boost::posix_time::min_date_time);
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("查询归档水位失败: {}", e.what());
+                return false;
+            }
+        }
+
+        // 把cutoff所在分区之前的消息从热表移入归档，全部完成(或归档租约由其他实例持有)返回true
+        // 归档目录须为所有实例共享的存储，owner为本实例名称，用于竞争归档租约
+        // 从最早的分区开始逐个处理: 按(create_time, _id)分批导出并追加到归档 ->
+        // 推进共享水位并等待各实例刷新(此后该分区的读取走归档) -> 分批从热表删除已导出的行
+        // 每批操作前续约，租约失效时立即停止；中途失败时已归档未删除的行下次会再归档一遍，读取时按message_id去重
+        bool archive(boost::posix_time::ptime cutoff, const std::string& owner) {
+            if (!_archive) {
+                return false;
+            }
+            _lease_owner = owner;
+            bool acquired = false;
+            if (!acquire_lease(acquired)) {
+                return false;
+            }
+            if (!acquired) {
+                LOG_DEBUG("归档租约由其他实例持有");
+                return true;
+            }
+            auto stop = _archive->partition_start(cutoff);
+            while (true) {
+                // 各分片共用一个归档和水位: 先从所有分片导出同一分区，再推进水位，最后逐个分片清理
+                auto shards = _shards->all();
+                boost::posix_time::ptime oldest(boost::posix_time::not_a_date_time);
+                for (const auto& shard : shards) {
+                    boost::posix_time::ptime shard_oldest;
+                    if (!oldest_before(*shard->primary(), stop, shard_oldest)) {
+                        return false;
+                    }
+                    if (!shard_oldest.is_not_a_date_time() && (oldest.is_not_a_date_time() || shard_oldest < oldest)) {
+                        oldest = shard_oldest;
+                    }
+                }
+                if (oldest.is_not_a_date_time()) {
+                    return true;
+                }
+                auto partition = _archive->partition_start(oldest);
+                auto next = _archive->next_partition(partition);
+                size_t exported = 0;
+                std::vector<MessageCursor> lasts(shards.size(), MessageCursor{ partition, 0 });
+                for (size_t i = 0; i < shards.size(); ++i) {
+                    if (!export_partition(*shards[i]->primary(), partition, next, lasts[i], exported)) {
+                        return false;
+                    }
+                }
+                if (!publish_horizon(next)) {
+                    return false;
+                }
+                _archive->set_horizon(next);
+                // 其他实例最多kHorizonRefreshMs后才读到新水位，在此之前仍从热表读取该分区
+                std::this_thread::sleep_for(std::chrono::milliseconds(2 * kHorizonRefreshMs));
+                for (size_t i = 0; i < shards.size(); ++i) {
+                    if (!purge_partition(*shards[i]->primary(), partition, next, lasts[i])) {
+                        return false;
+                    }
+                }
+                LOG_INFO("消息分区{}已归档{}条", boost::posix_time::to_simple_string(partition), exported);
+            }
+        }
     private:
-        std::shared_ptr<odb::database> _db;
+        static constexpr size_t kMaxBatchRows = 500; // 单条INSERT的最大行数，避免超出max_allowed_packet
+        static constexpr int kArchiveChunk = 5000;    // 归档时每次导出/删除的行数
+        static constexpr int kArchiveLeaseSec = 120;  // 归档租约有效期，每批操作前续约
+        static constexpr int kHorizonRefreshMs = 5000; // 各实例从数据库刷新水位的周期
+
+        // 单个分片的批量插入
+        bool insert_batch(DBRouter& shard, const std::vector<Message>& messages) {
+            auto& db = *shard.primary();
+            try {
+                odb::transaction trans(db.begin());
+                auto& conn = static_cast<odb::mysql::connection&>(trans.connection());
+                for (size_t begin = 0; begin < messages.size(); begin += kMaxBatchRows) {
+                    size_t end = std::min(messages.size(), begin + kMaxBatchRows);
+                    std::string sql = "INSERT INTO message (message_id, user_id, session_id, message_type, "
+                        "create_time, content, file_id, file_name, file_size) VALUES ";
+                    for (size_t i = begin; i < end; ++i) {
+                        const auto& m = messages[i];
+                        if (i != begin) sql += ",";
+                        sql += "(" + quote(conn, m.message_id());
+                        sql += "," + quote(conn, m.user_id());
+                        sql += "," + quote(conn, m.session_id());
+                        sql += "," + std::to_string(static_cast<unsigned int>(m.message_type()));
+                        sql += "," + quote(conn, to_sql_time(m.create_time()));
+                        // 空值与nullable未设置对读取方等价，统一写为NULL
+                        sql += "," + (m.content().empty() ? std::string("NULL") : quote(conn, m.content()));
+                        sql += "," + (m.file_id().empty() ? std::string("NULL") : quote(conn, m.file_id()));
+                        sql += "," + (m.file_name().empty() ? std::string("NULL") : quote(conn, m.file_name()));
+                        sql += "," + (m.file_size() == 0 ? std::string("NULL") : std::to_string(m.file_size()));
+                        sql += ")";
+                    }
+                    db.execute(sql);
+                }
+                trans.commit();
+                std::unordered_set<std::string> sessions;
+                for (const auto& m : messages) {
+                    if (sessions.insert(m.session_id()).second) shard.wrote(m.session_id());
+                }
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("批量新增{}条消息失败: {}", messages.size(), e.what());
+                return false;
+            }
+        }
+        // 热表只保存水位之后的消息；未配置归档时不限制
+        // 水位以数据库中的为准，每kHorizonRefreshMs刷新一次本地副本
+        boost::posix_time::ptime hot_horizon() const {
+            if (!_archive) {
+                return boost::posix_time::ptime(boost::posix_time::min_date_time);
+            }
+            if (_archive->refresh_due(std::chrono::milliseconds(kHorizonRefreshMs))) {
+                boost::posix_time::ptime horizon;
+                if (shared_horizon(horizon)) {
+                    _archive->set_horizon(horizon);
+                }
+            }
+            return _archive->horizon();
+        }
+        // 获取或续约归档租约: 租约空闲、已过期或本就属于_lease_owner时acquired为true
+        bool acquire_lease(bool& acquired) {
+            auto& db = *_shards->home()->primary();
+            try {
+                odb::transaction trans(db.begin());
+                auto& conn = static_cast<odb::mysql::connection&>(trans.connection());
+                std::string id = std::to_string(MessageArchiveState::kId);
+                std::string owner = quote(conn, _lease_owner);
+                db.execute("INSERT IGNORE INTO message_archive_state (id) VALUES (" + id + ")");
+                // lease_until精确到微秒，续约时总会变化，受影响行数为1即成功
+                auto rows = db.execute("UPDATE message_archive_state SET owner = " + owner +
+                    ", lease_until = NOW(6) + INTERVAL " + std::to_string(kArchiveLeaseSec) + " SECOND"
+                    " WHERE id = " + id + " AND (owner IS NULL OR owner = " + owner + " OR lease_until < NOW(6))");
+                trans.commit();
+                acquired = rows == 1;
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("获取归档租约失败: {}", e.what());
+                return false;
+            }
+        }
+        // 续约，租约已被其他实例取得时返回false
+        bool renew_lease() {
+            bool acquired = false;
+            if (!acquire_lease(acquired)) {
+                return false;
+            }
+            if (!acquired) {
+                LOG_WARN("归档租约已失效，停止归档");
+            }
+            return acquired;
+        }
+        // 持有租约时把共享水位推进到horizon(只增不减)并续约，租约已失效时返回false
+        bool publish_horizon(boost::posix_time::ptime horizon) {
+            auto& db = *_shards->home()->primary();
+            try {
+                odb::transaction trans(db.begin());
+                auto& conn = static_cast<odb::mysql::connection&>(trans.connection());
+                std::string value = quote(conn, to_sql_time(horizon));
+                auto rows = db.execute("UPDATE message_archive_state SET horizon = GREATEST(COALESCE(horizon, " + value + "), " + value + ")"
+                    ", lease_until = NOW(6) + INTERVAL " + std::to_string(kArchiveLeaseSec) + " SECOND"
+                    " WHERE id = " + std::to_string(MessageArchiveState::kId) +
+                    " AND owner = " + quote(conn, _lease_owner) + " AND lease_until >= NOW(6)");
+                trans.commit();
+                if (rows != 1) {
+                    LOG_WARN("归档租约已失效，未推进水位");
+                    return false;
+                }
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("推进归档水位失败: {}", e.what());
+                return false;
+            }
+        }
+        // 热表中早于stop的最早消息时间，没有时为not_a_date_time
+        bool oldest_before(odb::database& db, boost::posix_time::ptime stop, boost::posix_time::ptime& oldest) {
+            oldest = boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+            try {
+                odb::transaction trans(db.begin());
+                using query = odb::query<Message>;
+                query q(query::create_time < stop);
+                q += "ORDER BY" + query::create_time + "ASC LIMIT 1";
+                std::unique_ptr<Message> m(db.query_one<Message>(q));
+                if (m) {
+                    oldest = m->create_time();
+                }
+                trans.commit();
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("查询待归档消息失败: {}", e.what());
+                return false;
+            }
+        }
+        // 按(create_time, _id)顺序分批导出[start, end)内的消息到归档，last为最后导出的位置
+        bool export_partition(odb::database& db, boost::posix_time::ptime start, boost::posix_time::ptime end,
+            MessageCursor& last, size_t& exported) {
+            while (true) {
+                if (!renew_lease()) {
+                    return false;
+                }
+                std::vector<Message> chunk;
+                try {
+                    odb::transaction trans(db.begin());
+                    using query = odb::query<Message>;
+                    using result = odb::result<Message>;
+                    query q(query::create_time < end);
+                    q += "AND (" + query::create_time + "," + query::id + ") > ("
+                        + query::_val(last.create_time) + "," + query::_val(last.id) + ")";
+                    q += "ORDER BY" + query::create_time + "ASC," + query::id + "ASC LIMIT" + query::_val(kArchiveChunk);
+                    result r(db.query<Message>(q));
+                    for (const auto& message : r) {
+                        chunk.push_back(message);
+                    }
+                    trans.commit();
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("导出消息分区{}失败: {}", boost::posix_time::to_simple_string(start), e.what());
+                    return false;
+                }
+                if (chunk.empty()) {
+                    return true;
+                }
+                if (!_archive->append(start, chunk)) {
+                    return false;
+                }
+                last = MessageCursor{ chunk.back().create_time(), chunk.back().id() };
+                exported += chunk.size();
+                if (static_cast<int>(chunk.size()) < kArchiveChunk) {
+                    return true;
+                }
+            }
+        }
+        // 分批删除[start, end)内不晚于last的消息，每批一个短事务，避免长时间锁表
+        bool purge_partition(odb::database& db, boost::posix_time::ptime start, boost::posix_time::ptime end,
+            const MessageCursor& last) {
+            while (true) {
+                if (!renew_lease()) {
+                    return false;
+                }
+                try {
+                    odb::transaction trans(db.begin());
+                    using query = odb::query<Message>;
+                    query q(query::create_time >= start && query::create_time < end);
+                    q += "AND (" + query::create_time + "," + query::id + ") <= ("
+                        + query::_val(last.create_time) + "," + query::_val(last.id) + ")";
+                    q += "LIMIT" + query::_val(kArchiveChunk);
+                    auto count = db.erase_query<Message>(q);
+                    trans.commit();
+                    if (count < static_cast<unsigned long long>(kArchiveChunk)) {
+                        return true;
+                    }
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("清理已归档消息分区{}失败: {}", boost::posix_time::to_simple_string(start), e.what());
+                    return false;
+                }
+            }
+        }
+
+        // 使用连接的字符集转义并加引号
+        static std::string quote(odb::mysql::connection& conn, const std::string& value) {
+            std::string escaped(value.size() * 2 + 1, '\0');
+            unsigned long n = mysql_real_escape_string(conn.handle(), &escaped[0], value.data(), value.size());
+            escaped.resize(n);
+            return "'" + escaped + "'";
+        }
+        static std::string to_sql_time(const boost::posix_time::ptime& time) {
+            std::string s = boost::posix_time::to_iso_extended_string(time);
+            auto pos = s.find('T');
+            if (pos != std::string::npos) s[pos] = ' ';
+            return s;
+        }
+
+        ShardRouter::Ptr _shards;
+        MessageArchive::Ptr _archive;
+        std::string _lease_owner; // archive只在归档线程中调用
     };
 } // namespace blus
@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <algorithm>
+#include <brpc/controller.h>
+
+namespace blus {
+    // 请求截止时间
+    // 请求中携带的是剩余时间预算(timeout_ms)而不是绝对时间，避免各机器时钟偏差；
+    // 每一跳收到请求时换算为本地单调时钟的截止时刻，调用下游前再换算回剩余预算
+    class Deadline {
+    public:
+        static constexpr int64_t kDefaultBudgetMs = 3000; // 请求未携带预算时使用的默认值
+        static constexpr int64_t kMinBudgetMs = 5; // 剩余预算低于该值视为已超时，不再发起下游调用
+
+        explicit Deadline(int64_t budget_ms = kDefaultBudgetMs)
+            : _deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms)) {
+        }
+
+        // 按请求携带的预算构造，未携带时使用默认值
+        template <typename Request>
+        static Deadline from(const Request& request) {
+            return Deadline(request.has_timeout_ms() && request.timeout_ms() > 0
+                ? request.timeout_ms() : kDefaultBudgetMs);
+        }
+
+        // 剩余时间(毫秒)，可能为负
+        int64_t remaining_ms() const {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                _deadline - std::chrono::steady_clock::now()).count();
+        }
+
+        bool expired() const {
+            return remaining_ms() < kMinBudgetMs;
+        }
+
+        // 调用下游前: 以剩余预算设置cntl超时，并写入下游请求；预算已耗尽时返回false
+        template <typename Request>
+        bool propagate(brpc::Controller* cntl, Request* request) const {
+            int64_t remaining = remaining_ms();
+            if (remaining < kMinBudgetMs) {
+                return false;
+            }
+            cntl->set_timeout_ms(remaining);
+            request->set_timeout_ms(remaining);
+            return true;
+        }
+    private:
+        std::chrono::steady_clock::time_point _deadline;
+    };
+}
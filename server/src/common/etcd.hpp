@@ -3,93 +3,559 @@
 #include <etcd/Response.hpp>
 #include <etcd/KeepAlive.hpp>
 #include <etcd/Watcher.hpp>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <json/json.h>
+#include <bvar/bvar.h>
 #include "logger.hpp"
+#include "load.hpp"
 
 namespace blus {
+    // 负载记录在etcd中的前缀: /load<service_name>/<instance>
+    inline std::string load_prefix(const std::string& service_name) {
+        return "/load" + service_name;
+    }
+
     class Registry {
     public:
         using Ptr = std::shared_ptr<Registry>;
+        // 租约申请与注册都在后台线程完成，etcd暂不可用时退避重试，不阻塞服务启动
         Registry(const std::string& service_name, const std::string& service_address, int ttl = 10)
             : _service_name(service_name)
             , _service_address(service_address)
             , _ttl(ttl)
-            , _client(new etcd::Client(_service_address))
-            , _lease(_client->leasekeepalive(_ttl).get())
-            , _lease_id(_lease->Lease()) {
+            , _client(new etcd::Client(_service_address)) {
+            _keeper = std::thread(&Registry::keep_loop, this);
         }
 
         ~Registry() {
-            _lease->Cancel();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            _keeper.join();
+            if (_reporter.joinable()) {
+                _reporter.join();
+            }
+            if (_lease) {
+                _lease->Cancel();
+            }
         }
 
+        // 登记后由后台线程在取得租约后写入etcd，写入失败时重试
         bool registry(const std::string& key, const std::string& value) {
-            auto response = _client->put(_service_name + "/" + key, value, _lease_id).get();
-            if (!response.is_ok()) {
-                LOG_ERROR("REG PUT FAILED: {}", response.error_message());
-                return false;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _entries[_service_name + "/" + key] = value;
+                _dirty = true;
             }
+            _cond.notify_all();
             return true;
         }
+
+        // 启动后台线程，周期上报本实例的负载记录，与注册信息共用租约
+        // 每kSampleIntervalMs采样一次，只有负载明显变化时才写etcd，否则最长kRefreshIntervalMs刷新一次
+        void report(const std::string& key, const std::string& addr, const LoadSampler::Ptr& sampler) {
+            if (_reporter.joinable()) {
+                LOG_WARN("负载上报已启动: {}", key);
+                return;
+            }
+            std::string load_key = load_prefix(_service_name) + "/" + key;
+            _reporter = std::thread([this, load_key, addr, sampler]() {
+                LoadRecord last;
+                auto last_put = std::chrono::steady_clock::time_point();
+                bool first = true;
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (!_cond.wait_for(lock, std::chrono::milliseconds(kSampleIntervalMs), [this] { return _stop; })) {
+                    if (_lease_id == 0) {
+                        // 尚未取得租约，不写无租约的记录
+                        continue;
+                    }
+                    auto record = sampler->sample(addr);
+                    auto now = std::chrono::steady_clock::now();
+                    if (!first && !record.differs(last) && now - last_put < std::chrono::milliseconds(kRefreshIntervalMs)) {
+                        continue;
+                    }
+                    int64_t lease_id = _lease_id;
+                    lock.unlock();
+                    auto response = _client->put(load_key, record.serialize(), lease_id).get();
+                    lock.lock();
+                    if (!response.is_ok()) {
+                        LOG_ERROR("LOAD PUT FAILED: {}", response.error_message());
+                        continue;
+                    }
+                    last = record;
+                    last_put = now;
+                    first = false;
+                }
+                });
+        }
     private:
+        // 后台线程: 申请租约，再把登记的注册信息写入etcd，失败时按指数退避重试
+        void keep_loop() {
+            int backoff_ms = kRetryMinBackoffMs;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stop) {
+                bool ok = true;
+                if (!_lease) {
+                    lock.unlock();
+                    auto lease = grant();
+                    lock.lock();
+                    if (lease) {
+                        _lease = lease;
+                        _lease_id = lease->Lease();
+                        _dirty = true;
+                        LOG_INFO("{}取得etcd租约: {}", _service_name, _lease_id);
+                    }
+                    ok = static_cast<bool>(lease);
+                }
+                if (ok && _dirty) {
+                    auto entries = _entries;
+                    int64_t lease_id = _lease_id;
+                    _dirty = false;
+                    lock.unlock();
+                    for (const auto& [key, value] : entries) {
+                        auto response = _client->put(key, value, lease_id).get();
+                        if (!response.is_ok()) {
+                            LOG_ERROR("REG PUT FAILED: {}", response.error_message());
+                            ok = false;
+                            break;
+                        }
+                    }
+                    lock.lock();
+                    if (!ok) {
+                        _dirty = true;
+                    }
+                }
+                if (!ok) {
+                    _cond.wait_for(lock, std::chrono::milliseconds(backoff_ms), [this] { return _stop; });
+                    backoff_ms = std::min(backoff_ms * 2, kRetryMaxBackoffMs);
+                    continue;
+                }
+                backoff_ms = kRetryMinBackoffMs;
+                _cond.wait(lock, [this] { return _stop || _dirty; });
+            }
+        }
+
+        std::shared_ptr<etcd::KeepAlive> grant() {
+            try {
+                return _client->leasekeepalive(_ttl).get();
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("LEASE GRANT FAILED: {}, 后台重试", e.what());
+                return nullptr;
+            }
+        }
+
+        static constexpr int kSampleIntervalMs = 1000; // 采样间隔，同时是写etcd的最小间隔
+        static constexpr int kRefreshIntervalMs = 10000; // 负载无变化时的最长刷新间隔
+        static constexpr int kRetryMinBackoffMs = 200; // 申请租约或注册失败后的初始重试间隔
+        static constexpr int kRetryMaxBackoffMs = 5000; // 申请租约或注册失败后的最长重试间隔
+
         std::string _service_name;
         std::string _service_address;
         int _ttl;
         std::shared_ptr<etcd::Client> _client;
+        std::mutex _mutex; // 保护以下状态
+        std::condition_variable _cond;
+        bool _stop = false;
         std::shared_ptr<etcd::KeepAlive> _lease;
-        uint64_t _lease_id;
+        int64_t _lease_id = 0; // 0表示尚未取得租约
+        std::unordered_map<std::string, std::string> _entries; // 登记的注册信息: 完整key -> value
+        bool _dirty = false; // 有注册信息尚未写入etcd
+        std::thread _keeper;
+        std::thread _reporter;
     };
 
 
+    // 一次服务拓扑变更，元素为(服务实例key, ip:port)
+    struct ServiceDiff {
+        std::vector<std::pair<std::string, std::string>> online;
+        std::vector<std::pair<std::string, std::string>> offline;
+
+        bool empty() const {
+            return online.empty() && offline.empty();
+        }
+    };
+
     class Discovery {
     public:
         using Ptr = std::shared_ptr<Discovery>;
         using callback_t = std::function<void(const std::string&, const std::string&)>;
+        using batch_callback_t = std::function<void(const ServiceDiff&)>;
+
+        // watch事件先按key合并(同一key只保留最后一次)，静默kDebounceMs或距首个事件kMaxDelayMs后
+        // 与已生效的拓扑对比得到一次变更，交给batch_cb整体应用，避免批量发布时逐个节点反复重建快照
+        // load_cb非空时同时关注该服务各实例上报的负载记录(key, 记录内容)，已有的记录由后台线程获取
+        // snapshot_path非空时把已生效的拓扑持久化到本地文件: 启动时先按快照交付，不等待etcd，
+        // 再由后台线程向etcd核对；没有快照且etcd不可用时也不退出，后台退避重试直到etcd恢复
         Discovery(const std::string& service_name, const std::string& service_address,
-            const callback_t& put_cb, const callback_t& delete_cb)
+            const batch_callback_t& batch_cb, const callback_t& load_cb = nullptr,
+            const std::string& snapshot_path = "")
             : _service_name(service_name)
             , _service_address(service_address)
-            , _put_cb(put_cb)
-            , _delete_cb(delete_cb)
-            , _client(std::make_shared<etcd::Client>(_service_address))
-            , _watcher(std::make_shared<etcd::Watcher>(*_client.get(), _service_name, [this](etcd::Response response) {
-            this->watch_callback(response);
-                }, true)) {
-            auto response = _client->ls(_service_name).get();
-            if (!response.is_ok()) {
-                LOG_CRITICAL("DIS LS FAILED: {}", response.error_message());
-                abort();
+            , _batch_cb(batch_cb)
+            , _load_cb(load_cb)
+            , _snapshot_path(snapshot_path)
+            , _client(std::make_shared<etcd::Client>(_service_address)) {
+            watch();
+            bool synced = false;
+            if (!load_snapshot()) {
+                auto response = _client->ls(_service_name).get();
+                if (response.is_ok()) {
+                    for (auto& v : response.values()) {
+                        _known[v.key()] = v.as_string();
+                    }
+                    save_snapshot(_known);
+                    synced = true;
+                }
+                else {
+                    LOG_ERROR("DIS LS FAILED: {}, 后台重试", response.error_message());
+                }
             }
-            for (auto& v : response.values()) {
-                _put_cb(v.key(), v.as_string());
+            if (!synced) {
+                // 快照可能已过期，或etcd暂不可用，交由后台与etcd核对
+                std::lock_guard<std::mutex> lock(_mutex);
+                _need_sync = true;
+            }
+            ServiceDiff initial;
+            for (const auto& [key, value] : _known) {
+                initial.online.emplace_back(key, value);
+            }
+            if (!initial.empty()) {
+                _batch_cb(initial);
             }
+            if (_load_cb) {
+                _load_watcher = std::make_shared<etcd::Watcher>(*_client.get(), load_prefix(_service_name), [this](etcd::Response response) {
+                    this->load_callback(response);
+                    }, true);
+                std::lock_guard<std::mutex> lock(_mutex);
+                _need_load_sync = true;
+            }
+            _flusher = std::thread(&Discovery::flush_loop, this);
+        }
+
+        // 逐个节点回调的接口，变更仍按批次合并，批内先下线后上线
+        Discovery(const std::string& service_name, const std::string& service_address,
+            const callback_t& put_cb, const callback_t& delete_cb, const callback_t& load_cb = nullptr,
+            const std::string& snapshot_path = "")
+            : Discovery(service_name, service_address, [put_cb, delete_cb](const ServiceDiff& diff) {
+            for (const auto& [key, value] : diff.offline) {
+                delete_cb(key, value);
+            }
+            for (const auto& [key, value] : diff.online) {
+                put_cb(key, value);
+            }
+                }, load_cb, snapshot_path) {
         }
 
         ~Discovery() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            _flusher.join();
             _watcher->Cancel();
+            if (_load_watcher) {
+                _load_watcher->Cancel();
+            }
+        }
+
+        // 拓扑变化统计: 收到的watch事件数与实际应用的变更批次数
+        int64_t watch_events() const {
+            return _watch_events.get_value();
+        }
+        int64_t topology_batches() const {
+            return _topology_batches.get_value();
+        }
+
+        // 快照文件路径: <dir>/<服务名中的'/'替换为'_'>.json，dir为空时不使用快照
+        static std::string snapshot_file(const std::string& dir, const std::string& service_name) {
+            if (dir.empty()) {
+                return "";
+            }
+            std::string name = service_name;
+            std::replace(name.begin(), name.end(), '/', '_');
+            return dir + "/" + name + ".json";
         }
     private:
+        struct Pending {
+            bool put;
+            std::string value;
+        };
+
+        // 创建(或在watch中断后重建)服务节点的watcher
+        void watch() {
+            if (_watcher) {
+                _watcher->Cancel();
+            }
+            _watcher = std::make_shared<etcd::Watcher>(*_client.get(), _service_name, [this](etcd::Response response) {
+                this->watch_callback(response);
+                }, true);
+        }
+
         void watch_callback(etcd::Response response) {
+            std::lock_guard<std::mutex> lock(_mutex);
             if (!response.is_ok()) {
+                // watch中断期间的事件会丢失，由后台重建watcher并全量核对
                 LOG_ERROR("WATCH FAILED: {}", response.error_message());
+                _need_sync = true;
+                _watch_broken = true;
+                _cond.notify_one();
                 return;
             }
+            auto now = std::chrono::steady_clock::now();
+            if (_pending.empty()) {
+                _first_event = now;
+            }
+            _last_event = now;
             for (const auto& ev : response.events()) {
                 if (ev.event_type() == etcd::Event::EventType::PUT) {
-                    _put_cb(ev.kv().key(), ev.kv().as_string());
+                    _pending[ev.kv().key()] = Pending{ true, ev.kv().as_string() };
                     LOG_DEBUG("WATCH PUT: {}, {}", ev.kv().key(), ev.kv().as_string());
                 }
                 else if (ev.event_type() == etcd::Event::EventType::DELETE_) {
-                    _delete_cb(ev.prev_kv().key(), ev.prev_kv().as_string());
+                    _pending[ev.prev_kv().key()] = Pending{ false, ev.prev_kv().as_string() };
                     LOG_DEBUG("WATCH DELETE: {}, {}", ev.prev_kv().key(), ev.prev_kv().as_string());
                 }
+                _watch_events << 1;
+            }
+            _cond.notify_one();
+        }
+
+        // 后台线程: 需要时向etcd全量核对，并在事件静默后把合并的事件作为一次变更交付
+        void flush_loop() {
+            int backoff_ms = kSyncMinBackoffMs;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                _cond.wait(lock, [this] { return _stop || _need_sync || _need_load_sync || !_pending.empty(); });
+                if (_stop) {
+                    return;
+                }
+                if (_need_load_sync) {
+                    _need_load_sync = false;
+                    lock.unlock();
+                    sync_loads();
+                    lock.lock();
+                }
+                if (_need_sync) {
+                    lock.unlock();
+                    bool ok = sync();
+                    lock.lock();
+                    if (!ok) {
+                        _cond.wait_for(lock, std::chrono::milliseconds(backoff_ms), [this] { return _stop; });
+                        backoff_ms = std::min(backoff_ms * 2, kSyncMaxBackoffMs);
+                        continue;
+                    }
+                    backoff_ms = kSyncMinBackoffMs;
+                }
+                while (!_stop && !_pending.empty()) {
+                    auto due = std::min(_last_event + std::chrono::milliseconds(kDebounceMs),
+                        _first_event + std::chrono::milliseconds(kMaxDelayMs));
+                    if (std::chrono::steady_clock::now() >= due) {
+                        break;
+                    }
+                    _cond.wait_until(lock, due);
+                }
+                if (_stop) {
+                    return;
+                }
+                auto diff = take_diff();
+                if (diff.empty()) {
+                    continue;
+                }
+                _topology_batches << 1;
+                LOG_INFO("{}拓扑变更: 上线{}个，下线{}个", _service_name, diff.online.size(), diff.offline.size());
+                auto known = _known;
+                lock.unlock();
+                _batch_cb(diff);
+                save_snapshot(known);
+                lock.lock();
+            }
+        }
+
+        // 全量获取服务节点，与已生效的拓扑的差异作为待交付事件立即交付
+        // watch中断时先重建watcher再获取，保证之后的变化不会遗漏
+        bool sync() {
+            bool rewatch = false;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                std::swap(rewatch, _watch_broken);
+            }
+            // Cancel会等待旧watcher的回调结束，不能持锁调用
+            if (rewatch) {
+                if (_watcher) {
+                    _watcher->Cancel();
+                    _watcher.reset();
+                }
+                // 中断前排队的事件可能早于下面的获取结果(如期间已恢复的节点的删除事件)，丢弃后以获取结果为准
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _pending.clear();
+                }
+                watch();
+            }
+            auto response = _client->ls(_service_name).get();
+            if (!response.is_ok()) {
+                LOG_ERROR("DIS LS FAILED: {}", response.error_message());
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::unordered_map<std::string, std::string> current;
+            for (auto& v : response.values()) {
+                current[v.key()] = v.as_string();
             }
+            // 获取期间到达的(新watcher的)事件比获取结果更新，保留事件
+            for (const auto& [key, value] : current) {
+                _pending.emplace(key, Pending{ true, value });
+            }
+            for (const auto& [key, value] : _known) {
+                if (!current.count(key)) {
+                    _pending.emplace(key, Pending{ false, value });
+                }
+            }
+            _first_event = std::chrono::steady_clock::time_point();
+            _need_sync = false;
+            LOG_INFO("{}与etcd核对完成，当前{}个节点", _service_name, current.size());
+            return true;
         }
 
+        // 获取各实例已上报的负载记录，之后的变化由负载watcher交付
+        void sync_loads() {
+            auto response = _client->ls(load_prefix(_service_name)).get();
+            if (!response.is_ok()) {
+                // 负载记录只影响权重，且各实例最长10秒重写一次，获取失败时不重试，等watcher交付
+                LOG_ERROR("DIS LOAD LS FAILED: {}", response.error_message());
+                return;
+            }
+            for (auto& v : response.values()) {
+                _load_cb(v.key(), v.as_string());
+            }
+        }
+
+        // 读取本地快照作为已生效的拓扑，快照不存在或无效时返回false
+        bool load_snapshot() {
+            if (_snapshot_path.empty()) {
+                return false;
+            }
+            std::ifstream ifs(_snapshot_path);
+            if (!ifs) {
+                return false;
+            }
+            Json::CharReaderBuilder builder;
+            Json::Value root;
+            std::string errs;
+            if (!Json::parseFromStream(builder, ifs, &root, &errs) || !root.isObject()
+                || root.get("service", "").asString() != _service_name || !root["nodes"].isObject()) {
+                LOG_WARN("服务发现快照{}无效: {}", _snapshot_path, errs);
+                return false;
+            }
+            const auto& nodes = root["nodes"];
+            for (const auto& key : nodes.getMemberNames()) {
+                _known[key] = nodes[key].asString();
+            }
+            LOG_INFO("{}从快照恢复{}个节点，快照写入于{}秒前", _service_name, _known.size(),
+                time(nullptr) - root.get("saved_at", 0).asInt64());
+            return true;
+        }
+
+        // 先写临时文件再rename，避免进程在写入中途退出留下残缺的快照
+        void save_snapshot(const std::unordered_map<std::string, std::string>& known) {
+            if (_snapshot_path.empty()) {
+                return;
+            }
+            Json::Value root;
+            root["service"] = _service_name;
+            root["saved_at"] = static_cast<Json::Int64>(time(nullptr));
+            root["nodes"] = Json::Value(Json::objectValue);
+            for (const auto& [key, value] : known) {
+                root["nodes"][key] = value;
+            }
+            std::string tmp = _snapshot_path + ".tmp";
+            {
+                std::ofstream ofs(tmp, std::ios::trunc);
+                if (!ofs) {
+                    LOG_ERROR("服务发现快照{}写入失败", tmp);
+                    return;
+                }
+                ofs << Json::writeString(Json::StreamWriterBuilder(), root);
+            }
+            if (std::rename(tmp.c_str(), _snapshot_path.c_str()) != 0) {
+                LOG_ERROR("服务发现快照{}替换失败", _snapshot_path);
+            }
+        }
+
+        // 需在持有_mutex时调用，对比已生效的拓扑得到变更，地址变化的实例先下线旧地址再上线新地址
+        ServiceDiff take_diff() {
+            ServiceDiff diff;
+            for (auto& [key, pending] : _pending) {
+                auto it = _known.find(key);
+                if (!pending.put) {
+                    if (it != _known.end()) {
+                        diff.offline.emplace_back(key, it->second);
+                        _known.erase(it);
+                    }
+                    continue;
+                }
+                if (it != _known.end()) {
+                    if (it->second == pending.value) {
+                        continue;
+                    }
+                    diff.offline.emplace_back(key, it->second);
+                }
+                diff.online.emplace_back(key, pending.value);
+                _known[key] = pending.value;
+            }
+            _pending.clear();
+            return diff;
+        }
+
+        // 负载记录只关心写入，记录随租约删除时节点本身也会下线
+        void load_callback(etcd::Response response) {
+            if (!response.is_ok()) {
+                LOG_ERROR("LOAD WATCH FAILED: {}", response.error_message());
+                return;
+            }
+            for (const auto& ev : response.events()) {
+                if (ev.event_type() == etcd::Event::EventType::PUT) {
+                    _load_cb(ev.kv().key(), ev.kv().as_string());
+                }
+            }
+        }
+
+        static constexpr int kDebounceMs = 50; // 事件静默多久后交付变更
+        static constexpr int kMaxDelayMs = 500; // 事件持续到达时，距首个事件的最长等待
+        static constexpr int kSyncMinBackoffMs = 200; // 向etcd核对失败后的初始重试间隔
+        static constexpr int kSyncMaxBackoffMs = 5000; // 向etcd核对失败后的最长重试间隔
+
         std::string _service_name;
         std::string _service_address;
-        callback_t _put_cb;
-        callback_t _delete_cb;
+        batch_callback_t _batch_cb;
+        callback_t _load_cb;
+        std::string _snapshot_path;
+        std::mutex _mutex; // 保护以下拓扑状态
+        std::condition_variable _cond;
+        bool _stop = false;
+        bool _need_sync = false; // 已生效的拓扑可能与etcd不一致(来自快照、etcd不可用或watch中断)
+        bool _watch_broken = false;
+        bool _need_load_sync = false; // 尚未获取已有的负载记录
+        std::unordered_map<std::string, Pending> _pending; // 尚未交付的事件，按key合并
+        std::unordered_map<std::string, std::string> _known; // 已交付的拓扑: 实例key -> ip:port
+        std::chrono::steady_clock::time_point _first_event;
+        std::chrono::steady_clock::time_point _last_event;
+        bvar::Adder<int64_t> _watch_events;
+        bvar::Adder<int64_t> _topology_batches;
+        std::thread _flusher;
         std::shared_ptr<etcd::Client> _client;
         std::shared_ptr<etcd::Watcher> _watcher;
+        std::shared_ptr<etcd::Watcher> _load_watcher;
     };
 }
@@ -0,0 +1,160 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+
+#include "logger.hpp"
+
+namespace blus {
+    // 执行阻塞I/O的专用线程池，每个后端(mysql/es/redis)一个
+    // ODB、elasticlient、redis++等同步客户端会占住所在的pthread，在brpc handler中直接调用会卡住bthread worker；
+    // run把任务交给本池的线程执行，调用方的bthread挂起等待(不占worker)，worker可以继续调度其他请求
+    // 队列有界: 排队数达到上限时直接拒绝，由调用方按后端繁忙返回，避免慢查询时请求无限堆积
+    // 指标(bvar): io_<name>_queue_depth 排队数, io_<name>_wait 排队耗时(微秒), io_<name>_exec 执行耗时(微秒),
+    // io_<name>_rejected 拒绝数
+    class IOExecutor {
+    public:
+        using Ptr = std::shared_ptr<IOExecutor>;
+
+        IOExecutor(const std::string& name, int threads, int max_queue)
+            : _name(name)
+            , _max_queue(std::max(1, max_queue))
+            , _queue_depth("io_" + name + "_queue_depth")
+            , _wait("io_" + name + "_wait")
+            , _exec("io_" + name + "_exec")
+            , _rejected("io_" + name + "_rejected") {
+            for (int i = 0; i < std::max(1, threads); ++i) {
+                _threads.emplace_back(&IOExecutor::worker, this);
+            }
+        }
+        ~IOExecutor() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            for (auto& thread : _threads) {
+                thread.join();
+            }
+        }
+
+        // 在本池线程上执行task并等待完成；在bthread中调用时只挂起当前bthread
+        // 队列已满或已停止时不执行，task抛出异常时记录日志，均返回false
+        bool run(const std::function<void()>& task) {
+            Job job{ &task };
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_stop || static_cast<int>(_queue.size()) >= _max_queue) {
+                    _rejected << 1;
+                    LOG_WARN("I/O执行器{}队列已满({}), 拒绝任务", _name, _max_queue);
+                    return false;
+                }
+                _queue.push_back(&job);
+                _queue_depth << 1;
+            }
+            _cond.notify_one();
+            job.done.wait();
+            return job.ok;
+        }
+
+    private:
+        struct Job {
+            const std::function<void()>* task;
+            std::chrono::steady_clock::time_point enqueued = std::chrono::steady_clock::now();
+            bthread::CountdownEvent done{ 1 };
+            bool ok = false;
+        };
+
+        void worker() {
+            while (true) {
+                Job* job = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait(lock, [this] { return _stop || !_queue.empty(); });
+                    if (_queue.empty()) {
+                        return;
+                    }
+                    job = _queue.front();
+                    _queue.pop_front();
+                    _queue_depth << -1;
+                }
+                auto start = std::chrono::steady_clock::now();
+                _wait << std::chrono::duration_cast<std::chrono::microseconds>(start - job->enqueued).count();
+                try {
+                    (*job->task)();
+                    job->ok = true;
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("I/O执行器{}任务异常: {}", _name, e.what());
+                }
+                _exec << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                // signal之后job所在的栈帧可能立即失效，不能再访问
+                job->done.signal();
+            }
+        }
+
+        std::string _name;
+        int _max_queue;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::deque<Job*> _queue;
+        bool _stop = false;
+        std::vector<std::thread> _threads;
+        bvar::Adder<int64_t> _queue_depth;
+        bvar::LatencyRecorder _wait;
+        bvar::LatencyRecorder _exec;
+        bvar::Adder<int64_t> _rejected;
+    };
+
+    // io为空时在当前线程直接执行，便于未配置执行器的场景(如测试)复用同一段代码
+    inline bool offload(const IOExecutor::Ptr& io, const std::function<void()>& task) {
+        if (!io) {
+            try {
+                task();
+                return true;
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("阻塞任务异常: {}", e.what());
+                return false;
+            }
+        }
+        return io->run(task);
+    }
+    // 同上，未执行时在应答中标记服务繁忙
+    template <typename Response>
+    bool offload(const IOExecutor::Ptr& io, Response* response, const std::function<void()>& task) {
+        if (offload(io, task)) {
+            return true;
+        }
+        response->set_success(false);
+        response->set_errmsg("服务繁忙");
+        return false;
+    }
+
+    // 一个服务用到的各后端执行器，为空的后端在调用方线程直接执行
+    struct IOExecutors {
+        IOExecutor::Ptr mysql;
+        IOExecutor::Ptr es;
+        IOExecutor::Ptr redis;
+        IOExecutor::Ptr classifier; // llm文本分类(httplib)
+
+        // threads<=0的后端不创建执行器
+        static IOExecutors create(int mysql_threads, int es_threads, int redis_threads, int classifier_threads, int max_queue) {
+            IOExecutors io;
+            if (mysql_threads > 0) io.mysql = std::make_shared<IOExecutor>("mysql", mysql_threads, max_queue);
+            if (es_threads > 0) io.es = std::make_shared<IOExecutor>("es", es_threads, max_queue);
+            if (redis_threads > 0) io.redis = std::make_shared<IOExecutor>("redis", redis_threads, max_queue);
+            if (classifier_threads > 0) io.classifier = std::make_shared<IOExecutor>("classifier", classifier_threads, max_queue);
+            return io;
+        }
+    };
+} // namespace blus
@@ -0,0 +1,136 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <json/json.h>
+
+#include "logger.hpp"
+
+namespace blus {
+    // 服务实例的负载记录，由Registry周期写入etcd，调用方据此做加权选择
+    struct LoadRecord {
+        std::string addr; // 实例的ip:port，与注册信息一致
+        int inflight = 0; // 正在处理的请求数
+        int queue_depth = 0; // 等待工作线程的请求数
+        double cpu = 0; // 机器CPU使用率[0, 1]
+        int weight = 100; // 容量权重，机器配置越高权重越大
+
+        std::string serialize() const {
+            Json::Value root;
+            root["addr"] = addr;
+            root["inflight"] = inflight;
+            root["queue"] = queue_depth;
+            root["cpu"] = cpu;
+            root["weight"] = weight;
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "";
+            return Json::writeString(builder, root);
+        }
+
+        static bool parse(const std::string& str, LoadRecord& record) {
+            Json::CharReaderBuilder builder;
+            std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+            Json::Value root;
+            std::string errs;
+            if (!reader->parse(str.data(), str.data() + str.size(), &root, &errs) || !root.isObject()) {
+                LOG_ERROR("负载记录解析失败: {}", errs);
+                return false;
+            }
+            record.addr = root.get("addr", "").asString();
+            record.inflight = root.get("inflight", 0).asInt();
+            record.queue_depth = root.get("queue", 0).asInt();
+            record.cpu = root.get("cpu", 0.0).asDouble();
+            record.weight = root.get("weight", 100).asInt();
+            return !record.addr.empty();
+        }
+
+        // 与上次写入的记录相比是否有明显变化，变化不大时不写etcd
+        bool differs(const LoadRecord& last) const {
+            return weight != last.weight
+                || std::fabs(cpu - last.cpu) >= 0.05
+                || std::abs(inflight - last.inflight) > std::max(2, last.inflight / 5)
+                || std::abs(queue_depth - last.queue_depth) > std::max(2, last.queue_depth / 5);
+        }
+    };
+
+    // 本实例的负载采样器
+    // 在途请求数由RPC入口处的InflightGuard维护，CPU使用率读取/proc/stat计算两次采样间的增量
+    class LoadSampler {
+    public:
+        using Ptr = std::shared_ptr<LoadSampler>;
+
+        // weight: 容量权重; worker_threads: RPC工作线程数，超出的在途请求计为排队
+        LoadSampler(int weight, int worker_threads)
+            : _weight(std::max(1, weight)), _worker_threads(std::max(1, worker_threads)) {
+            read_cpu(_last_busy, _last_total);
+        }
+
+        // RPC入口处构造，离开作用域时在途请求数减1
+        class InflightGuard {
+        public:
+            explicit InflightGuard(const Ptr& sampler) : _sampler(sampler.get()) {
+                if (_sampler) {
+                    _sampler->_inflight.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            ~InflightGuard() {
+                if (_sampler) {
+                    _sampler->_inflight.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+            InflightGuard(const InflightGuard&) = delete;
+            InflightGuard& operator=(const InflightGuard&) = delete;
+        private:
+            LoadSampler* _sampler;
+        };
+
+        LoadRecord sample(const std::string& addr) {
+            LoadRecord record;
+            record.addr = addr;
+            record.inflight = _inflight.load(std::memory_order_relaxed);
+            record.queue_depth = std::max(0, record.inflight - _worker_threads);
+            record.weight = _weight;
+            std::lock_guard<std::mutex> lock(_mutex);
+            uint64_t busy = 0, total = 0;
+            if (read_cpu(busy, total) && total > _last_total) {
+                _cpu = static_cast<double>(busy - _last_busy) / (total - _last_total);
+                _last_busy = busy;
+                _last_total = total;
+            }
+            record.cpu = _cpu;
+            return record;
+        }
+    private:
+        // 读取/proc/stat中所有CPU的累计时间，busy不含idle与iowait
+        static bool read_cpu(uint64_t& busy, uint64_t& total) {
+            std::ifstream ifs("/proc/stat");
+            std::string line;
+            if (!ifs || !std::getline(ifs, line)) {
+                return false;
+            }
+            std::istringstream iss(line);
+            std::string cpu;
+            uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+            iss >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal;
+            if (cpu != "cpu") {
+                return false;
+            }
+            busy = user + nice + system + irq + softirq + steal;
+            total = busy + idle + iowait;
+            return true;
+        }
+
+        int _weight;
+        int _worker_threads;
+        std::atomic<int> _inflight{ 0 };
+        std::mutex _mutex; // 保护CPU采样状态
+        uint64_t _last_busy = 0;
+        uint64_t _last_total = 0;
+        double _cpu = 0;
+    };
+}
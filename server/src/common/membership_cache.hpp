@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+#include "ttl_cache.hpp"
+
+namespace blus {
+    // 字符串驻留: 每个不同的字符串只保存一份，以32位编号引用
+    // 只增不减，适合取值范围有限的ID(如用户ID)
+    class StringInterner {
+    public:
+        uint32_t intern(const std::string& value) {
+            {
+                std::shared_lock<std::shared_mutex> lock(_mutex);
+                auto it = _ids.find(value);
+                if (it != _ids.end()) {
+                    return it->second;
+                }
+            }
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            auto [it, inserted] = _ids.emplace(value, static_cast<uint32_t>(_values.size()));
+            if (inserted) {
+                _values.push_back(value);
+            }
+            return it->second;
+        }
+        // id必须来自intern
+        std::string resolve(uint32_t id) const {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            return _values[id];
+        }
+        void resolve(const std::vector<uint32_t>& ids, std::vector<std::string>& values) const {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            values.reserve(values.size() + ids.size());
+            for (auto id : ids) {
+                values.push_back(_values[id]);
+            }
+        }
+        size_t size() const {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            return _values.size();
+        }
+    private:
+        mutable std::shared_mutex _mutex;
+        std::unordered_map<std::string, uint32_t> _ids;
+        std::deque<std::string> _values;
+    };
+
+    // 会话成员的进程内缓存，避免每条消息都查询一次chat_session_member
+    // 成员以驻留后的用户编号按升序保存，500人的群约2KB
+    // 条目ttl_sec秒后过期；成员变更时由变更事件调用invalidate立即失效
+    class MembershipCache {
+    public:
+        using Ptr = std::shared_ptr<MembershipCache>;
+        // 从数据库加载会话成员，失败返回false
+        using Loader = std::function<bool(std::vector<std::string>& members)>;
+
+        explicit MembershipCache(int ttl_sec = 60, size_t max_sessions = 65536)
+            : _cache(ttl_sec, max_sessions) {
+        }
+
+        // 命中时直接返回，否则调用loader加载并缓存；loader失败时返回false
+        // 成员为空的结果不缓存(无法与加载失败区分)
+        bool get(const std::string& session_id, std::vector<std::string>& members, const Loader& loader) {
+            std::vector<uint32_t> ids;
+            if (_cache.get(session_id, ids)) {
+                _interner.resolve(ids, members);
+                return true;
+            }
+            auto token = _cache.token(session_id);
+            if (!loader(members)) {
+                return false;
+            }
+            if (members.empty()) {
+                return true;
+            }
+            ids.reserve(members.size());
+            for (const auto& member : members) {
+                ids.push_back(_interner.intern(member));
+            }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            _cache.put(session_id, std::move(ids), token);
+            return true;
+        }
+
+        void invalidate(const std::string& session_id) {
+            _cache.invalidate(session_id);
+        }
+        void clear() {
+            _cache.clear();
+        }
+        size_t size() const {
+            return _cache.size();
+        }
+    private:
+        TtlCache<std::vector<uint32_t>> _cache;
+        StringInterner _interner;
+    };
+} // namespace blus
@@ -0,0 +1,466 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+#include <unistd.h>
+#include <zlib.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "message.hxx"
+#include "logger.hpp"
+
+namespace blus {
+    // 冷消息归档: 按时间分区(每partition_months个月一个分区)，每个分区两个只追加的文件
+    //   message-YYYYMM.arc  数据块，每块为同一会话一批消息(按时间正序)的zlib压缩编码
+    //   message-YYYYMM.idx  块索引，每条记录会话ID、块位置及块内消息的时间范围
+    // 先写数据块再写索引，进程在中途退出时索引不会指向不完整的数据；重复归档的消息按message_id去重
+    // 早于水位(horizon)的消息只在归档中读取，水位及之后的消息在热表中
+    // 多个实例共用一个归档时目录须为共享存储；水位以数据库(MessageTable)中的为准，这里只是本进程的副本
+    class MessageArchive {
+    public:
+        using Ptr = std::shared_ptr<MessageArchive>;
+        static constexpr size_t kBlockMessages = 1000; // 单个数据块最多的消息数
+
+        MessageArchive(const std::string& dir, int partition_months = 1)
+            : _dir(dir)
+            , _partition_months(std::max(1, partition_months)) {
+            std::error_code ec;
+            std::filesystem::create_directories(_dir, ec);
+            if (ec) {
+                LOG_ERROR("创建消息归档目录{}失败: {}", _dir, ec.message());
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            scan_partitions();
+        }
+
+        // t所在分区的起始时间
+        boost::posix_time::ptime partition_start(boost::posix_time::ptime t) const {
+            auto d = t.date();
+            int months = static_cast<int>(d.year()) * 12 + d.month() - 1;
+            months -= months % _partition_months;
+            return boost::posix_time::ptime(boost::gregorian::date(months / 12, months % 12 + 1, 1));
+        }
+        boost::posix_time::ptime next_partition(boost::posix_time::ptime start) const {
+            return boost::posix_time::ptime(start.date() + boost::gregorian::months(_partition_months));
+        }
+
+        // 早于水位的消息都已归档；每次读取历史消息都会调用，不加锁
+        boost::posix_time::ptime horizon() const {
+            return from_micros(_horizon.load(std::memory_order_acquire));
+        }
+        // 更新为数据库中的水位(只增不减)；水位推进时重新扫描目录并丢弃缓存的块索引，
+        // 以读到其他实例新归档的分区和数据块(水位越过的分区不再追加，此后读入的索引是完整的)
+        void set_horizon(boost::posix_time::ptime horizon) {
+            int64_t micros = to_micros(horizon);
+            int64_t current = _horizon.load(std::memory_order_relaxed);
+            if (micros <= current) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                scan_partitions();
+                _indexes.clear();
+            }
+            while (micros > current && !_horizon.compare_exchange_weak(current, micros, std::memory_order_release)) {
+            }
+        }
+        // 距上次从数据库刷新水位已超过interval时返回true，并发调用时只有一个返回true
+        bool refresh_due(std::chrono::milliseconds interval) {
+            int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t last = _refreshed_ms.load(std::memory_order_relaxed);
+            return now - last >= interval.count() && _refreshed_ms.compare_exchange_strong(last, now);
+        }
+
+        // 把同一分区的一批消息追加到归档，按会话分组写成数据块
+        bool append(boost::posix_time::ptime partition, const std::vector<Message>& messages) {
+            if (messages.empty()) {
+                return true;
+            }
+            std::map<std::string, std::vector<const Message*>> sessions;
+            for (const auto& m : messages) {
+                sessions[m.session_id()].push_back(&m);
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::string name = partition_name(partition);
+            FILE* data = std::fopen((_dir + "/" + name + ".arc").c_str(), "ab");
+            if (data == nullptr) {
+                LOG_ERROR("打开归档文件{}失败", name);
+                return false;
+            }
+            std::fseek(data, 0, SEEK_END);
+            uint64_t offset = static_cast<uint64_t>(std::ftell(data));
+            std::string index;
+            std::vector<std::pair<std::string, BlockRef>> refs;
+            bool ok = true;
+            for (auto& [session_id, list] : sessions) {
+                std::sort(list.begin(), list.end(), [](const Message* a, const Message* b) {
+                    return std::make_pair(a->create_time(), a->id()) < std::make_pair(b->create_time(), b->id());
+                    });
+                for (size_t begin = 0; begin < list.size() && ok; begin += kBlockMessages) {
+                    size_t end = std::min(list.size(), begin + kBlockMessages);
+                    std::string raw;
+                    for (size_t i = begin; i < end; ++i) {
+                        encode(*list[i], raw);
+                    }
+                    std::string packed;
+                    if (!compress(raw, packed) || std::fwrite(packed.data(), 1, packed.size(), data) != packed.size()) {
+                        LOG_ERROR("写入归档数据块失败 {} {}", name, session_id);
+                        ok = false;
+                        break;
+                    }
+                    BlockRef ref{ offset, static_cast<uint32_t>(packed.size()), static_cast<uint32_t>(raw.size()),
+                        list[begin]->create_time(), list[end - 1]->create_time() };
+                    offset += packed.size();
+                    encode_index(session_id, ref, index);
+                    refs.emplace_back(session_id, ref);
+                }
+            }
+            ok = ok && sync(data);
+            std::fclose(data);
+            if (!ok) {
+                return false;
+            }
+            FILE* idx = std::fopen((_dir + "/" + name + ".idx").c_str(), "ab");
+            if (idx == nullptr) {
+                LOG_ERROR("打开归档索引{}失败", name);
+                return false;
+            }
+            ok = std::fwrite(index.data(), 1, index.size(), idx) == index.size() && sync(idx);
+            std::fclose(idx);
+            if (!ok) {
+                LOG_ERROR("写入归档索引{}失败", name);
+                return false;
+            }
+            _partitions.insert(partition);
+            auto it = _indexes.find(partition);
+            if (it != _indexes.end()) {
+                for (auto& [session_id, ref] : refs) {
+                    (*it->second)[session_id].push_back(ref);
+                }
+            }
+            return true;
+        }
+
+        // 会话在[start, end]内的归档消息，按(create_time, id)正序
+        std::vector<Message> read(const std::string& session_id,
+            boost::posix_time::ptime start, boost::posix_time::ptime end) {
+            std::vector<Message> messages;
+            for (auto p : partitions_between(start, end)) {
+                read_partition(p, session_id, start, end, messages);
+            }
+            return finish(messages);
+        }
+        // 会话中(create_time, id)早于(time, id)的最近count条归档消息，按正序返回
+        std::vector<Message> read_before(const std::string& session_id,
+            boost::posix_time::ptime time, unsigned long id, size_t count) {
+            std::vector<Message> messages;
+            auto parts = partitions_between(boost::posix_time::ptime(boost::posix_time::min_date_time), time);
+            // 从最新的分区往前读，凑够count条即可停止
+            for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+                std::vector<Message> part;
+                read_partition(*it, session_id, *it, time, part);
+                for (auto& m : part) {
+                    if (std::make_pair(m.create_time(), m.id()) < std::make_pair(time, id)) {
+                        messages.push_back(std::move(m));
+                    }
+                }
+                messages = finish(messages);
+                if (messages.size() >= count) {
+                    messages.erase(messages.begin(), messages.end() - count);
+                    break;
+                }
+            }
+            return messages;
+        }
+        // 会话中(create_time, id)晚于(time, id)且不晚于end的最早count条归档消息，按正序返回
+        std::vector<Message> read_after(const std::string& session_id,
+            boost::posix_time::ptime time, unsigned long id, boost::posix_time::ptime end, size_t count) {
+            std::vector<Message> messages;
+            for (auto p : partitions_between(time, end)) {
+                std::vector<Message> part;
+                read_partition(p, session_id, time, end, part);
+                for (auto& m : part) {
+                    if (std::make_pair(m.create_time(), m.id()) > std::make_pair(time, id)) {
+                        messages.push_back(std::move(m));
+                    }
+                }
+                messages = finish(messages);
+                if (messages.size() >= count) {
+                    messages.resize(count);
+                    break;
+                }
+            }
+            return messages;
+        }
+
+    private:
+        struct BlockRef {
+            uint64_t offset;
+            uint32_t packed_size;
+            uint32_t raw_size;
+            boost::posix_time::ptime first;
+            boost::posix_time::ptime last;
+        };
+        using PartitionIndex = std::unordered_map<std::string, std::vector<BlockRef>>;
+
+        std::string partition_name(boost::posix_time::ptime start) const {
+            auto d = start.date();
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "message-%04d%02d", static_cast<int>(d.year()), static_cast<int>(d.month()));
+            return buf;
+        }
+        static bool parse_index_name(const std::string& file, boost::posix_time::ptime& start) {
+            int year = 0, month = 0;
+            char tail[8] = { 0 };
+            if (file.size() != std::strlen("message-YYYYMM.idx") ||
+                std::sscanf(file.c_str(), "message-%4d%2d.%3s", &year, &month, tail) != 3 ||
+                std::strcmp(tail, "idx") != 0 || month < 1 || month > 12) {
+                return false;
+            }
+            start = boost::posix_time::ptime(boost::gregorian::date(year, month, 1));
+            return true;
+        }
+
+        // 需持有_mutex
+        void scan_partitions() {
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(_dir, ec)) {
+                boost::posix_time::ptime start;
+                if (parse_index_name(entry.path().filename().string(), start)) {
+                    _partitions.insert(start);
+                }
+            }
+        }
+
+        std::vector<boost::posix_time::ptime> partitions_between(boost::posix_time::ptime start, boost::posix_time::ptime end) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::vector<boost::posix_time::ptime> parts;
+            for (auto it = _partitions.lower_bound(partition_start(start)); it != _partitions.end() && *it <= end; ++it) {
+                parts.push_back(*it);
+            }
+            return parts;
+        }
+
+        void read_partition(boost::posix_time::ptime partition, const std::string& session_id,
+            boost::posix_time::ptime start, boost::posix_time::ptime end, std::vector<Message>& out) {
+            auto blocks = blocks_of(partition, session_id);
+            if (blocks.empty()) {
+                return;
+            }
+            std::string name = partition_name(partition);
+            FILE* data = std::fopen((_dir + "/" + name + ".arc").c_str(), "rb");
+            if (data == nullptr) {
+                LOG_ERROR("打开归档文件{}失败", name);
+                return;
+            }
+            for (const auto& ref : blocks) {
+                if (ref.last < start || ref.first > end) {
+                    continue;
+                }
+                std::string packed(ref.packed_size, '\0');
+                std::string raw;
+                if (std::fseek(data, static_cast<long>(ref.offset), SEEK_SET) != 0 ||
+                    std::fread(&packed[0], 1, packed.size(), data) != packed.size() ||
+                    !uncompress(packed, ref.raw_size, raw)) {
+                    LOG_ERROR("读取归档数据块失败 {} offset {}", name, ref.offset);
+                    continue;
+                }
+                size_t pos = 0;
+                Message m;
+                while (decode(raw, pos, m)) {
+                    if (m.create_time() >= start && m.create_time() <= end) {
+                        out.push_back(m);
+                    }
+                }
+            }
+            std::fclose(data);
+        }
+
+        // 会话在分区中的数据块，分区的块索引首次访问时读入并缓存，末尾不完整的记录忽略
+        std::vector<BlockRef> blocks_of(boost::posix_time::ptime partition, const std::string& session_id) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _indexes.find(partition);
+            if (it == _indexes.end()) {
+                it = _indexes.emplace(partition, load_index(partition)).first;
+            }
+            auto blocks = it->second->find(session_id);
+            if (blocks == it->second->end()) {
+                return {};
+            }
+            return blocks->second;
+        }
+        std::shared_ptr<PartitionIndex> load_index(boost::posix_time::ptime partition) {
+            auto index = std::make_shared<PartitionIndex>();
+            std::ifstream ifs(_dir + "/" + partition_name(partition) + ".idx", std::ios::binary);
+            if (!ifs) {
+                return index;
+            }
+            std::string buf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            size_t pos = 0;
+            std::string session_id;
+            BlockRef ref;
+            while (decode_index(buf, pos, session_id, ref)) {
+                (*index)[session_id].push_back(ref);
+            }
+            return index;
+        }
+
+        // 按(create_time, id)排序并按message_id去重
+        static std::vector<Message> finish(std::vector<Message>& messages) {
+            std::sort(messages.begin(), messages.end(), [](const Message& a, const Message& b) {
+                return std::make_pair(a.create_time(), a.id()) < std::make_pair(b.create_time(), b.id());
+                });
+            std::vector<Message> unique;
+            std::unordered_set<std::string> seen;
+            for (auto& m : messages) {
+                if (seen.insert(m.message_id()).second) {
+                    unique.push_back(std::move(m));
+                }
+            }
+            return unique;
+        }
+
+        static bool sync(FILE* file) {
+            return std::fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+        }
+        static bool compress(const std::string& raw, std::string& packed) {
+            uLongf size = compressBound(raw.size());
+            packed.resize(size);
+            if (compress2(reinterpret_cast<Bytef*>(&packed[0]), &size,
+                reinterpret_cast<const Bytef*>(raw.data()), raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+                return false;
+            }
+            packed.resize(size);
+            return true;
+        }
+        static bool uncompress(const std::string& packed, uint32_t raw_size, std::string& raw) {
+            uLongf size = raw_size;
+            raw.resize(raw_size);
+            return ::uncompress(reinterpret_cast<Bytef*>(&raw[0]), &size,
+                reinterpret_cast<const Bytef*>(packed.data()), packed.size()) == Z_OK && size == raw_size;
+        }
+
+        // 小端定长整数与带长度前缀的字符串
+        template <typename T>
+        static void put(std::string& out, T v) {
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                out.push_back(static_cast<char>((static_cast<uint64_t>(v) >> (8 * i)) & 0xff));
+            }
+        }
+        template <typename T>
+        static bool get(const std::string& in, size_t& pos, T& v) {
+            if (pos + sizeof(T) > in.size()) {
+                return false;
+            }
+            uint64_t x = 0;
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                x |= static_cast<uint64_t>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+            }
+            v = static_cast<T>(x);
+            pos += sizeof(T);
+            return true;
+        }
+        static void put_str(std::string& out, const std::string& s) {
+            put<uint32_t>(out, s.size());
+            out += s;
+        }
+        static bool get_str(const std::string& in, size_t& pos, std::string& s) {
+            uint32_t size = 0;
+            if (!get(in, pos, size) || pos + size > in.size()) {
+                return false;
+            }
+            s.assign(in, pos, size);
+            pos += size;
+            return true;
+        }
+        static constexpr int64_t kNoHorizon = INT64_MIN; // 未归档过，早于任何消息
+        static int64_t to_micros(boost::posix_time::ptime t) {
+            if (t.is_special()) {
+                return kNoHorizon;
+            }
+            static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            return (t - epoch).total_microseconds();
+        }
+        static boost::posix_time::ptime from_micros(int64_t micros) {
+            if (micros == kNoHorizon) {
+                return boost::posix_time::ptime(boost::posix_time::min_date_time);
+            }
+            static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            return epoch + boost::posix_time::microseconds(micros);
+        }
+
+        // 空字符串/0与nullable未设置对读取方等价，与热表批量写入一致
+        static void encode(const Message& m, std::string& out) {
+            put<uint64_t>(out, m.id());
+            put_str(out, m.message_id());
+            put_str(out, m.user_id());
+            put_str(out, m.session_id());
+            put<uint8_t>(out, m.message_type());
+            put<int64_t>(out, to_micros(m.create_time()));
+            put_str(out, m.content());
+            put_str(out, m.file_id());
+            put_str(out, m.file_name());
+            put<uint32_t>(out, m.file_size());
+        }
+        static bool decode(const std::string& in, size_t& pos, Message& m) {
+            uint64_t id = 0;
+            uint8_t type = 0;
+            int64_t micros = 0;
+            uint32_t file_size = 0;
+            std::string message_id, user_id, session_id, content, file_id, file_name;
+            if (!get(in, pos, id) || !get_str(in, pos, message_id) || !get_str(in, pos, user_id) ||
+                !get_str(in, pos, session_id) || !get(in, pos, type) || !get(in, pos, micros) ||
+                !get_str(in, pos, content) || !get_str(in, pos, file_id) || !get_str(in, pos, file_name) ||
+                !get(in, pos, file_size)) {
+                return false;
+            }
+            m = Message(message_id, user_id, session_id, type, from_micros(micros));
+            m.id(id);
+            if (!content.empty()) m.content(content);
+            if (!file_id.empty()) m.file_id(file_id);
+            if (!file_name.empty()) m.file_name(file_name);
+            if (file_size != 0) m.file_size(file_size);
+            return true;
+        }
+        static void encode_index(const std::string& session_id, const BlockRef& ref, std::string& out) {
+            put_str(out, session_id);
+            put<uint64_t>(out, ref.offset);
+            put<uint32_t>(out, ref.packed_size);
+            put<uint32_t>(out, ref.raw_size);
+            put<int64_t>(out, to_micros(ref.first));
+            put<int64_t>(out, to_micros(ref.last));
+        }
+        static bool decode_index(const std::string& in, size_t& pos, std::string& session_id, BlockRef& ref) {
+            int64_t first = 0, last = 0;
+            if (!get_str(in, pos, session_id) || !get(in, pos, ref.offset) || !get(in, pos, ref.packed_size) ||
+                !get(in, pos, ref.raw_size) || !get(in, pos, first) || !get(in, pos, last)) {
+                return false;
+            }
+            ref.first = from_micros(first);
+            ref.last = from_micros(last);
+            return true;
+        }
+
+        std::string _dir;
+        int _partition_months;
+        mutable std::mutex _mutex; // 保护分区列表、块索引及归档文件的追加
+        std::atomic<int64_t> _horizon{ kNoHorizon }; // 水位(epoch微秒)
+        std::atomic<int64_t> _refreshed_ms{ INT64_MIN / 2 }; // 上次刷新水位的时间(steady_clock毫秒)
+        std::set<boost::posix_time::ptime> _partitions;
+        std::map<boost::posix_time::ptime, std::shared_ptr<PartitionIndex>> _indexes;
+    };
+} // namespace blus
@@ -1,5 +1,7 @@
 #pragma once
 #include <ev.h>
+#include <vector>
+#include <algorithm>
 #include <amqpcpp.h>
 #include <amqpcpp/libev.h>
 #include <openssl/ssl.h>
@@ -10,6 +12,7 @@ namespace blus {
     class RabbitMQ {
     public:
         using MessageCallback = std::function<void(const std::string&)>;
+        using BatchCallback = std::function<void(const std::vector<std::string>&)>;
         using Ptr = std::shared_ptr<RabbitMQ>;
         RabbitMQ(const std::string& user,
             const std::string& password,
@@ -32,18 +35,17 @@ namespace blus {
             _thread.join();
         }
 
+        // queue_flags为队列属性，如AMQP::autodelete(最后一个消费者断开后删除)
         void declareComponents(const std::string& exchange,
             const std::string& queue,
             std::string routingKey = "__same__",
-            AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct) {
+            AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct,
+            int queue_flags = 0) {
             if (routingKey == "__same__") {
                 routingKey = queue;
             }
-            _channel->declareExchange(exchange, exchange_type).onError([exchange](const char* message) {
-                LOG_ERROR("声明交换机{}失败: {}", exchange, message);
-                exit(1);
-                });
-            _channel->declareQueue(queue).onError([queue](const char* message) {
+            declareExchange(exchange, exchange_type);
+            _channel->declareQueue(queue, queue_flags).onError([queue](const char* message) {
                 LOG_ERROR("声明队列{}失败: {}", queue, message);
                 exit(1);
                 });
@@ -52,6 +54,14 @@ namespace blus {
                 exit(1);
                 });
         }
+        // 只声明交换机，用于只发布不消费的一方
+        void declareExchange(const std::string& exchange,
+            AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct) {
+            _channel->declareExchange(exchange, exchange_type).onError([exchange](const char* message) {
+                LOG_ERROR("声明交换机{}失败: {}", exchange, message);
+                exit(1);
+                });
+        }
         bool publish(const std::string& exchange,
             const std::string& routingKey,
             const std::string& message) {
@@ -74,7 +84,62 @@ namespace blus {
                 exit(1);
                     });
         }
+        // 批量消费: 攒够max_batch条或首条到达后max_delay_ms毫秒即回调一次，
+        // 回调返回后以multiple标志一次确认整批(因此同一通道上只应有一个批量消费者)；
+        // 预取数设为两批，保证下一批在处理期间持续到达
+        void consume_batch(const std::string& queue,
+            size_t max_batch,
+            int max_delay_ms,
+            const BatchCallback& callback) {
+            auto batch = std::make_unique<Batch>();
+            batch->self = this;
+            batch->max_batch = std::max<size_t>(max_batch, 1);
+            batch->callback = callback;
+            ev_timer_init(&batch->timer, batch_timer_callback, 0., std::max(max_delay_ms, 1) / 1000.0);
+            batch->timer.data = batch.get();
+            Batch* b = batch.get();
+            _batches.push_back(std::move(batch));
+
+            _channel->setQos(static_cast<uint16_t>(std::min<size_t>(b->max_batch * 2, 65535)));
+            _channel->consume(queue, 0).onReceived([this, b](const AMQP::Message& message,
+                uint64_t deliveryTag,
+                bool redelivered) {
+                    b->bodies.emplace_back(message.body(), message.bodySize());
+                    b->last_tag = deliveryTag;
+                    if (b->bodies.size() >= b->max_batch) {
+                        flush(b);
+                    }
+                    else if (b->bodies.size() == 1) {
+                        ev_timer_again(_loop, &b->timer);
+                    }
+                })
+                .onError([](const char* message) {
+                LOG_ERROR("消费消息失败: {}", message);
+                exit(1);
+                    });
+        }
     private:
+        // 一个批量消费者的缓冲状态，只在事件循环线程中访问
+        struct Batch {
+            RabbitMQ* self;
+            size_t max_batch;
+            BatchCallback callback;
+            std::vector<std::string> bodies;
+            uint64_t last_tag = 0;
+            ev_timer timer;
+        };
+
+        void flush(Batch* b) {
+            ev_timer_stop(_loop, &b->timer);
+            if (b->bodies.empty()) return;
+            b->callback(b->bodies);
+            _channel->ack(b->last_tag, AMQP::multiple);
+            b->bodies.clear();
+        }
+        static void batch_timer_callback(struct ev_loop* loop, struct ev_timer* w, int32_t revents) {
+            auto b = static_cast<Batch*>(w->data);
+            b->self->flush(b);
+        }
         static void watcher_callback(struct ev_loop* loop, struct ev_async* w, int32_t revents) {
             ev_break(loop, EVBREAK_ALL);
         }
@@ -84,5 +149,6 @@ namespace blus {
         std::unique_ptr<AMQP::TcpChannel> _channel;
         struct ev_loop* _loop;
         std::thread _thread;
+        std::vector<std::unique_ptr<Batch>> _batches;
     };
 }
@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <json/json.h>
+
+#include "logger.hpp"
+
+namespace blus {
+    // 按chat_session_id分片的映射表: 会话ID哈希到固定的kSlots个槽，每个槽归属一个分片
+    // 迁移槽时发布新版本，把槽的owner改为目标分片并标记moving_from为源分片:
+    // 迁移期间写入同时落两个分片，读取仍走源分片；数据补齐后再发布去掉moving_from的版本，读取切到目标分片
+    // JSON格式:
+    // {"version": 2, "shards": ["default", "10.0.0.2:3306"],
+    //  "ranges": [{"from": 0, "to": 511, "shard": 0}, {"from": 512, "to": 1023, "shard": 1, "moving_from": 0}]}
+    // shards中的"default"表示服务启动参数配置的数据库
+    struct ShardMap {
+        static constexpr int kSlots = 1024;
+
+        int64_t version = 0;
+        std::vector<std::string> shards;   // 分片数据库地址host:port
+        std::vector<int> owner;            // 槽 -> 分片下标
+        std::vector<int> moving_from;      // 槽 -> 迁移源分片下标，-1表示不在迁移
+
+        // 只有一个分片的映射表
+        static ShardMap single(const std::string& shard) {
+            ShardMap map;
+            map.shards.push_back(shard);
+            map.owner.assign(kSlots, 0);
+            map.moving_from.assign(kSlots, -1);
+            return map;
+        }
+
+        // FNV-1a，与进程和编译器无关，各服务实例算出的槽一致
+        static int slot_of(const std::string& session_id) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (unsigned char c : session_id) {
+                hash ^= c;
+                hash *= 1099511628211ULL;
+            }
+            return static_cast<int>(hash % kSlots);
+        }
+
+        // 解析并校验: 每个槽恰好被一个区间覆盖，分片下标有效
+        static bool parse(const std::string& str, ShardMap& map) {
+            Json::CharReaderBuilder builder;
+            std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+            Json::Value root;
+            std::string errs;
+            if (!reader->parse(str.data(), str.data() + str.size(), &root, &errs) || !root.isObject()
+                || !root["shards"].isArray() || !root["ranges"].isArray()) {
+                LOG_ERROR("分片映射解析失败: {}", errs);
+                return false;
+            }
+            ShardMap result;
+            result.version = root.get("version", 0).asInt64();
+            for (const auto& shard : root["shards"]) {
+                result.shards.push_back(shard.asString());
+            }
+            int n = static_cast<int>(result.shards.size());
+            result.owner.assign(kSlots, -1);
+            result.moving_from.assign(kSlots, -1);
+            for (const auto& range : root["ranges"]) {
+                int from = range.get("from", -1).asInt();
+                int to = range.get("to", -1).asInt();
+                int shard = range.get("shard", -1).asInt();
+                int moving = range.get("moving_from", -1).asInt();
+                if (from < 0 || to >= kSlots || from > to || shard < 0 || shard >= n || moving >= n || moving == shard) {
+                    LOG_ERROR("分片映射v{}区间无效: [{}, {}] -> {}", result.version, from, to, shard);
+                    return false;
+                }
+                for (int slot = from; slot <= to; ++slot) {
+                    if (result.owner[slot] != -1) {
+                        LOG_ERROR("分片映射v{}槽{}重复分配", result.version, slot);
+                        return false;
+                    }
+                    result.owner[slot] = shard;
+                    result.moving_from[slot] = moving;
+                }
+            }
+            for (int slot = 0; slot < kSlots; ++slot) {
+                if (result.owner[slot] == -1) {
+                    LOG_ERROR("分片映射v{}槽{}未分配", result.version, slot);
+                    return false;
+                }
+            }
+            map = std::move(result);
+            return true;
+        }
+    };
+} // namespace blus
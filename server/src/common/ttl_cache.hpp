@@ -0,0 +1,149 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <array>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+namespace blus {
+    // 按key分片加锁的进程内缓存，条目ttl_sec秒后过期，总条目数有上限
+    // 用法: get未命中时先取token，再从数据源加载，最后put(key, value, token)；
+    // 加载期间该key所在分片发生过失效(invalidate)时put不写入，避免旧数据覆盖失效
+    // fresh_sec>0时记住失效时间: 数据源带有落后的副本(如mysql从库)时，失效后fresh_sec秒内的加载应读取最新数据
+    template <typename Value>
+    class TtlCache {
+    public:
+        TtlCache(int ttl_sec, size_t max_entries, int fresh_sec = 0)
+            : _ttl(std::chrono::seconds(ttl_sec))
+            , _fresh(std::chrono::seconds(fresh_sec))
+            , _max_per_shard(std::max<size_t>(1, max_entries / kShards)) {
+        }
+
+        // 命中且未过期时拷贝到value
+        bool get(const std::string& key, Value& value) const {
+            auto& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.entries.find(key);
+            if (it == shard.entries.end() || it->second.expire <= std::chrono::steady_clock::now()) {
+                return false;
+            }
+            value = it->second.value;
+            return true;
+        }
+        // 加载前调用，交给put判断加载期间是否发生过失效
+        uint64_t token(const std::string& key) const {
+            auto& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.generation;
+        }
+        void put(const std::string& key, Value value, uint64_t token) {
+            auto& shard = shard_of(key);
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.generation != token) {
+                return;
+            }
+            if (shard.entries.size() >= _max_per_shard && !shard.entries.count(key)) {
+                evict(shard, now);
+            }
+            shard.entries[key] = Entry{ std::move(value), now + _ttl };
+        }
+        // 该key在最近fresh_sec秒内被失效过，加载时应绕过可能落后的副本
+        bool fresh_required(const std::string& key) const {
+            auto& shard = shard_of(key);
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (now < shard.all_fresh_until) {
+                return true;
+            }
+            auto it = shard.fresh_until.find(key);
+            if (it == shard.fresh_until.end()) {
+                return false;
+            }
+            if (it->second <= now) {
+                shard.fresh_until.erase(it);
+                return false;
+            }
+            return true;
+        }
+
+        void invalidate(const std::string& key) {
+            auto& shard = shard_of(key);
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ++shard.generation;
+            shard.entries.erase(key);
+            if (_fresh.count() > 0) {
+                if (shard.fresh_until.size() >= _max_per_shard) {
+                    for (auto it = shard.fresh_until.begin(); it != shard.fresh_until.end();) {
+                        it = it->second <= now ? shard.fresh_until.erase(it) : std::next(it);
+                    }
+                }
+                // 仍然满时整个分片按全部失效处理
+                if (shard.fresh_until.size() >= _max_per_shard) {
+                    shard.fresh_until.clear();
+                    shard.all_fresh_until = now + _fresh;
+                }
+                else {
+                    shard.fresh_until[key] = now + _fresh;
+                }
+            }
+        }
+        void clear() {
+            auto now = std::chrono::steady_clock::now();
+            for (auto& shard : _shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                ++shard.generation;
+                shard.entries.clear();
+                shard.fresh_until.clear();
+                if (_fresh.count() > 0) {
+                    shard.all_fresh_until = now + _fresh;
+                }
+            }
+        }
+        size_t size() const {
+            size_t n = 0;
+            for (auto& shard : _shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                n += shard.entries.size();
+            }
+            return n;
+        }
+    private:
+        static constexpr size_t kShards = 16;
+
+        struct Entry {
+            Value value;
+            std::chrono::steady_clock::time_point expire;
+        };
+        struct Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<std::string, Entry> entries;
+            uint64_t generation = 0; // 每次失效递增
+            std::unordered_map<std::string, std::chrono::steady_clock::time_point> fresh_until; // 失效的key -> 需读取最新数据的截止时间
+            std::chrono::steady_clock::time_point all_fresh_until; // 整个分片被失效时的截止时间
+        };
+
+        Shard& shard_of(const std::string& key) const {
+            return _shards[std::hash<std::string>()(key) % kShards];
+        }
+        // 分片已满: 先清理过期条目，仍然满时淘汰任意一个
+        void evict(Shard& shard, std::chrono::steady_clock::time_point now) {
+            for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+                it = it->second.expire <= now ? shard.entries.erase(it) : std::next(it);
+            }
+            if (shard.entries.size() >= _max_per_shard) {
+                shard.entries.erase(shard.entries.begin());
+            }
+        }
+
+        std::chrono::steady_clock::duration _ttl;
+        std::chrono::steady_clock::duration _fresh;
+        size_t _max_per_shard;
+        mutable std::array<Shard, kShards> _shards;
+    };
+} // namespace blus
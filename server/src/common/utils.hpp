@@ -31,10 +31,10 @@ namespace blus {
         return ss.str();
     }
 
-    std::string hashPassword(const std::string& password) {
-        std::string salted_password = password + SALT; // 加盐
+    // 计算sha256, 返回64个字符的十六进制字符串
+    std::string sha256(const std::string& data) {
         unsigned char hash[SHA256_DIGEST_LENGTH]; // 256-bit = 32 字节
-        SHA256(reinterpret_cast<const unsigned char*>(salted_password.c_str()), salted_password.length(), hash);
+        SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), hash);
 
         std::ostringstream oss;
         for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) { // 32 字节，每字节转 2 位十六进制
@@ -44,6 +44,10 @@ namespace blus {
         return oss.str(); // 64 个字符的十六进制字符串
     }
 
+    std::string hashPassword(const std::string& password) {
+        return sha256(password + SALT); // 加盐
+    }
+
     bool readFile(const std::filesystem::path& filepath, std::string& body) {
         std::ifstream ifs(filepath, std::ios::in | std::ios::binary);
         if (!ifs) {
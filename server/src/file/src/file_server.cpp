@@ -17,6 +17,7 @@ DEFINE_int32(etcd_timeout, 3, "ttl");
 DEFINE_int32(listen_port, 7070, "Rpc监听端口");
 DEFINE_int32(rpc_timeout, -1, "Rpc超时时间");
 DEFINE_int32(rpc_threads, 1, "Rpc线程数");
+DEFINE_int32(capacity_weight, 100, "实例容量权重, 按机器配置设置, 调用方据此按比例分配流量");
 
 
 
@@ -26,6 +27,7 @@ int main(int argc, char* argv[]) {
     blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
 
     blus::FileServerBuilder builder(FLAGS_file_save_path);
+    builder.make_load(FLAGS_capacity_weight, FLAGS_rpc_threads);
     builder.make_etcd(FLAGS_etcd_address, FLAGS_file_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout);
     builder.make_rpc(FLAGS_listen_port, FLAGS_rpc_threads, FLAGS_rpc_timeout);
     auto server = builder.build();
@@ -8,11 +8,14 @@
 
 #include "utils.hpp"
 #include "etcd.hpp"
+#include "deadline.hpp"
 
 namespace blus {
     class FileServiceImpl : public FileService {
     public:
-        FileServiceImpl(const std::filesystem::path& save_path) : _save_path(save_path) {}
+        FileServiceImpl(const std::filesystem::path& save_path, const LoadSampler::Ptr& sampler = nullptr)
+            : _save_path(save_path), _sampler(sampler) {
+        }
         ~FileServiceImpl() {}
 
         void GetSingleFile(google::protobuf::RpcController* controller,
@@ -20,7 +23,14 @@ namespace blus {
             GetSingleFileRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
+            if (Deadline::from(*request).expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             std::string fid = request->file_id();
             std::string body;
             if (readFile(_save_path / fid, body)) {
@@ -39,7 +49,14 @@ namespace blus {
             GetMultiFileRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
+            if (Deadline::from(*request).expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             for (int i = 0; i < request->file_id_list_size(); i++) {
                 std::string fid = request->file_id_list(i);
                 std::string body;
@@ -64,7 +81,14 @@ namespace blus {
             PutSingleFileRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
+            if (Deadline::from(*request).expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             std::string fid = uuid();
             if (writeFile(_save_path / fid, request->file_data().file_content())) {
                 response->set_success(true);
@@ -83,7 +107,14 @@ namespace blus {
             PutMultiFileRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
+            if (Deadline::from(*request).expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             std::string fid = uuid();
             for (int i = 0; i < request->file_data_size(); i++) {
                 std::string fid = uuid();
@@ -104,6 +135,7 @@ namespace blus {
         }
     private:
         std::filesystem::path _save_path;
+        LoadSampler::Ptr _sampler;
     };
 
     class FileServer {
@@ -126,6 +158,12 @@ namespace blus {
     public:
         FileServerBuilder(const std::filesystem::path& save_path) : _save_path(save_path) {}
 
+        // 设置负载采样，需在make_etcd与make_rpc之前调用
+        bool make_load(int capacity_weight, int worker_threads) {
+            _sampler = std::make_shared<LoadSampler>(capacity_weight, worker_threads);
+            return true;
+        }
+
         // 设置etcd服务
         bool make_etcd(const std::string& etcd_addr,
             const std::string& service_name,
@@ -135,6 +173,9 @@ namespace blus {
             int etcd_timeout) {
             _reg = make_shared<Registry>(service_name, etcd_addr, etcd_timeout);
             _reg->registry(instance_name, service_ip + ":" + to_string(service_port));
+            if (_sampler) {
+                _reg->report(instance_name, service_ip + ":" + to_string(service_port), _sampler);
+            }
             return true;
         }
 
@@ -142,7 +183,7 @@ namespace blus {
         bool make_rpc(int32_t listen_port, uint8_t thread_num, int rpc_timeout) {
             _server = make_shared<brpc::Server>();
 
-            auto service = new FileServiceImpl(_save_path);
+            auto service = new FileServiceImpl(_save_path, _sampler);
             int ret = _server->AddService(service, brpc::SERVER_OWNS_SERVICE);
             if (ret != 0) {
                 LOG_ERROR("FileServer添加服务失败");
@@ -176,5 +217,6 @@ namespace blus {
         Registry::Ptr _reg;
         std::shared_ptr<brpc::Server> _server;
         std::filesystem::path _save_path;
+        LoadSampler::Ptr _sampler;
     };
 }
\ No newline at end of file
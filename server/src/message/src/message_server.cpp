@@ -14,6 +14,14 @@ DEFINE_string(mysql_host, "localhost", "mysql服务器地址");
 DEFINE_int32(mysql_port, 3306, "mysql服务器端口");
 DEFINE_int32(mysql_conn_pool_count, 10, "mysql连接池大小");
 DEFINE_string(mysql_socket, "", "mysql socket路径");
+DEFINE_string(mysql_replicas, "", "mysql只读从库地址, 逗号分隔的host:port, 为空时读写都走主库");
+DEFINE_string(mysql_shard_map_key, "", "etcd中会话分片映射表的key, 为空时不分片");
+
+DEFINE_string(message_archive_dir, "", "冷消息归档目录, 为空时不归档; 已有消息归档后所有实例都必须配置");
+DEFINE_int32(message_partition_months, 1, "消息按时间分区的月数");
+DEFINE_int32(message_hot_months, 3, "热表保留最近多少个月的消息, 更早的分区移入归档");
+DEFINE_int32(message_archive_interval_sec, 3600, "归档检查周期(秒)");
+DEFINE_bool(message_archive_shared, false, "归档目录是否为所有message实例共享的存储(如NFS), 只有共享时才执行归档; 单实例部署可直接设为true");
 
 DEFINE_string(etcd_address, "", "etcd注册中心地址");
 DEFINE_string(file_service_name, "", "文件管理服务名称");
@@ -23,16 +31,22 @@ DEFINE_string(instance_name, "", "实例名称");
 DEFINE_string(service_ip, "", "实例供外部访问的ip");
 DEFINE_int32(service_port, 0, "服务端口");
 DEFINE_int32(etcd_timeout, 3, "ttl");
+DEFINE_string(discovery_snapshot_dir, "", "服务发现快照目录, 启动时先按快照提供服务再与etcd核对, 为空时不使用");
 
 DEFINE_string(rabbitmq_host, "127.0.0.1:5672", "RabbitMQ 服务器地址, 带端口");
 DEFINE_string(rabbitmq_user, "root", "RabbitMQ 用户名");
 DEFINE_string(rabbitmq_password, "", "RabbitMQ 密码");
 DEFINE_string(rabbitmq_msg_exchange, "", "RabbitMQ 交换机名称");
 DEFINE_string(rabbitmq_msg_queue, "", "RabbitMQ 队列名称");
+DEFINE_int32(rabbitmq_batch_size, 64, "消息持久化每批最多条数");
+DEFINE_int32(rabbitmq_batch_delay_ms, 20, "消息持久化攒批最长等待(毫秒)");
 
 DEFINE_int32(listen_port, 7070, "Rpc监听端口");
 DEFINE_int32(rpc_timeout, -1, "Rpc超时时间");
 DEFINE_int32(rpc_threads, 1, "Rpc线程数");
+DEFINE_int32(io_mysql_threads, 8, "执行mysql阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_es_threads, 4, "执行es阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_queue_size, 256, "每个后端阻塞调用的最大排队数, 超出时直接返回服务繁忙");
 
 int main(int argc, char* argv[]) {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -41,9 +55,16 @@ int main(int argc, char* argv[]) {
 
     blus::MsgStorageServerBuilder builder{ FLAGS_file_service_name, FLAGS_user_service_name };
     builder.make_es({ FLAGS_es_url });
-    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8");
-    builder.make_etcd(FLAGS_etcd_address, FLAGS_message_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout);
-    builder.make_rabbitmq(FLAGS_rabbitmq_user, FLAGS_rabbitmq_password, FLAGS_rabbitmq_host, FLAGS_rabbitmq_msg_exchange, FLAGS_rabbitmq_msg_queue);
+    builder.make_io(FLAGS_io_mysql_threads, FLAGS_io_es_threads, FLAGS_io_queue_size);
+    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8", FLAGS_mysql_replicas);
+    if (!FLAGS_mysql_shard_map_key.empty()) {
+        builder.make_shard_map(FLAGS_etcd_address, FLAGS_mysql_shard_map_key, FLAGS_discovery_snapshot_dir);
+    }
+    if (!FLAGS_message_archive_dir.empty()) {
+        builder.make_archive(FLAGS_message_archive_dir, FLAGS_message_partition_months, FLAGS_message_hot_months, FLAGS_message_archive_interval_sec, FLAGS_message_archive_shared, FLAGS_instance_name);
+    }
+    builder.make_etcd(FLAGS_etcd_address, FLAGS_message_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout, FLAGS_discovery_snapshot_dir);
+    builder.make_rabbitmq(FLAGS_rabbitmq_user, FLAGS_rabbitmq_password, FLAGS_rabbitmq_host, FLAGS_rabbitmq_msg_exchange, FLAGS_rabbitmq_msg_queue, FLAGS_rabbitmq_batch_size, FLAGS_rabbitmq_batch_delay_ms);
     builder.make_rpc(FLAGS_listen_port, FLAGS_rpc_threads, FLAGS_rpc_timeout);
     auto server = builder.build();
     if (server) {
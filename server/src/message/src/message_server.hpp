@@ -14,22 +14,27 @@
 #include "data_mysql.hpp"
 #include "rabbitmq.hpp"
 #include "channel.hpp"
+#include "deadline.hpp"
+#include "io_executor.hpp"
 #include "logger.hpp"
 
 namespace blus {
     class MsgStorageServiceImpl : public MsgStorageService {
     public:
         MsgStorageServiceImpl(const std::shared_ptr<elasticlient::Client>& es,
-            const std::shared_ptr<odb::database>& mysql,
+            const ShardRouter::Ptr& mysql,
+            const MessageArchive::Ptr& archive,
             const std::string& file_service_name,
             const std::string& user_service_name,
-            const ServiceManager::Ptr& sm)
+            const ServiceManager::Ptr& sm,
+            const IOExecutors& io = {})
             : _es(es), _mysql(mysql)
             , _es_message(std::make_shared<ESMessage>(_es))
-            , _message_table(std::make_shared<MessageTable>(_mysql))
+            , _message_table(std::make_shared<MessageTable>(_mysql, archive))
             , _file_service_name(file_service_name)
             , _user_service_name(user_service_name)
-            , _service_manager(sm) {
+            , _service_manager(sm)
+            , _io(io) {
             if (!_es_message->createIndex()) {
                 LOG_ERROR("创建消息索引失败");
                 exit(EXIT_FAILURE);
@@ -43,10 +48,40 @@ namespace blus {
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
             response->set_request_id(request->request_id());
+            auto deadline = Deadline::from(*request);
+            if (deadline.expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             const auto& chat_session_id = request->chat_session_id();
             auto start = boost::posix_time::from_time_t(request->start_time());
             auto end = boost::posix_time::from_time_t(request->over_time());
-            auto msg_list = _message_table->get_range(chat_session_id, start, end);
+            // 区间内的消息按页返回: 每页条数有上限，且整页(含文件内容)不超过kHistoryBudgetBytes
+            MessageCursor cursor;
+            const MessageCursor* after = nullptr;
+            if (request->has_cursor() && !request->cursor().empty()) {
+                if (!MessageCursor::decode(request->cursor(), cursor)) {
+                    LOG_WARN("{} 无效的分页游标: {}", request->request_id(), request->cursor());
+                    response->set_success(false);
+                    response->set_errmsg("无效的分页游标");
+                    return;
+                }
+                after = &cursor;
+            }
+            int page_size = request->has_page_size() && request->page_size() > 0 ? request->page_size() : kHistoryPageSize;
+            std::string next_cursor;
+            std::vector<Message> msg_list;
+            if (!offload(_io.mysql, response, [&] {
+                msg_list = _message_table->get_range_page(chat_session_id, start, end, after, page_size, next_cursor);
+                })) {
+                return;
+            }
+            // 先按记录的文件大小估算，只为预算内的消息获取文件
+            trim_to_budget(msg_list, next_cursor, [](const Message& msg) {
+                return msg.content().size() + msg.file_size();
+                });
             // 调用file服务批量获取文件内容
             std::vector<std::string> file_ids;
             for (const auto& msg : msg_list) {
@@ -55,13 +90,18 @@ namespace blus {
                 }
                 file_ids.push_back(msg.file_id());
             }
-            auto file_data = _get_files(request->request_id(), file_ids);
+            auto file_data = _get_files(request->request_id(), file_ids, deadline);
             if (file_data.size() != file_ids.size()) {
                 LOG_ERROR("获取文件内容失败");
                 response->set_success(false);
                 response->set_errmsg("获取文件内容失败");
                 return;
             }
+            // 图片、语音消息不记录文件大小，按实际内容再校验一次
+            trim_to_budget(msg_list, next_cursor, [&file_data](const Message& msg) {
+                auto it = msg.file_id().empty() ? file_data.end() : file_data.find(msg.file_id());
+                return msg.content().size() + (it == file_data.end() ? 0 : it->second.file_content().size());
+                });
             // 调用user服务批量获取用户信息
             std::vector<std::string> user_ids;
             for (const auto& msg : msg_list) {
@@ -69,7 +109,7 @@ namespace blus {
             }
             // 对user_ids去重得到新的去重vector 
             std::unordered_set<std::string> user_id_set(user_ids.begin(), user_ids.end());
-            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()));
+            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()), deadline);
             if (user_info.size() != user_id_set.size()) {
                 LOG_ERROR("获取用户信息失败");
                 response->set_success(false);
@@ -110,6 +150,9 @@ namespace blus {
                     abort();
                 }
             }
+            if (!next_cursor.empty()) {
+                response->set_next_cursor(next_cursor);
+            }
             response->set_success(true);
         }
 
@@ -119,8 +162,37 @@ namespace blus {
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
             response->set_request_id(request->request_id());
+            auto deadline = Deadline::from(*request);
+            if (deadline.expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             const auto& chat_session_id = request->chat_session_id();
-            auto msg_list = _message_table->get_recent(chat_session_id, request->msg_count());
+            // 游标优先，其次按cur_time取该时间之前的消息，都没有时从最新消息开始
+            MessageCursor cursor;
+            const MessageCursor* before = nullptr;
+            if (request->has_cursor() && !request->cursor().empty()) {
+                if (!MessageCursor::decode(request->cursor(), cursor)) {
+                    LOG_WARN("{} 无效的分页游标: {}", request->request_id(), request->cursor());
+                    response->set_success(false);
+                    response->set_errmsg("无效的分页游标");
+                    return;
+                }
+                before = &cursor;
+            }
+            else if (request->has_cur_time() && request->cur_time() > 0) {
+                cursor = MessageCursor::before(boost::posix_time::from_time_t(request->cur_time()));
+                before = &cursor;
+            }
+            std::string next_cursor;
+            std::vector<Message> msg_list;
+            if (!offload(_io.mysql, response, [&] {
+                msg_list = _message_table->get_page(chat_session_id, before, request->msg_count(), next_cursor);
+                })) {
+                return;
+            }
             // 调用file服务批量获取文件内容
             std::vector<std::string> file_ids;
             for (const auto& msg : msg_list) {
@@ -129,7 +201,7 @@ namespace blus {
                 }
                 file_ids.push_back(msg.file_id());
             }
-            auto file_data = _get_files(request->request_id(), file_ids);
+            auto file_data = _get_files(request->request_id(), file_ids, deadline);
             if (file_data.size() != file_ids.size()) {
                 LOG_ERROR("获取文件内容失败");
                 response->set_success(false);
@@ -143,7 +215,7 @@ namespace blus {
             }
             // 对user_ids去重得到新的去重vector 
             std::unordered_set<std::string> user_id_set(user_ids.begin(), user_ids.end());
-            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()));
+            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()), deadline);
             if (user_info.size() != user_id_set.size()) {
                 LOG_ERROR("获取用户信息失败");
                 response->set_success(false);
@@ -184,6 +256,9 @@ namespace blus {
                     abort();
                 }
             }
+            if (!next_cursor.empty()) {
+                response->set_next_cursor(next_cursor);
+            }
             response->set_success(true);
         }
 
@@ -193,8 +268,18 @@ namespace blus {
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
             response->set_request_id(request->request_id());
+            auto deadline = Deadline::from(*request);
+            if (deadline.expired()) {
+                LOG_WARN("{} 请求已超时，放弃处理", request->request_id());
+                response->set_success(false);
+                response->set_errmsg("请求已超时");
+                return;
+            }
             const auto& chat_session_id = request->chat_session_id();
-            auto msg_list = _es_message->search(request->search_key(), chat_session_id);
+            std::vector<Message> msg_list;
+            if (!offload(_io.es, response, [&] { msg_list = _es_message->search(request->search_key(), chat_session_id); })) {
+                return;
+            }
             // 调用user服务批量获取用户信息
             std::vector<std::string> user_ids;
             for (const auto& msg : msg_list) {
@@ -202,7 +287,7 @@ namespace blus {
             }
             // 对user_ids去重得到新的去重vector 
             std::unordered_set<std::string> user_id_set(user_ids.begin(), user_ids.end());
-            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()));
+            auto user_info = _get_users(request->request_id(), std::vector<std::string>(user_id_set.begin(), user_id_set.end()), deadline);
             if (user_info.size() != user_id_set.size()) {
                 LOG_ERROR("获取用户信息失败");
                 response->set_success(false);
@@ -222,20 +307,44 @@ namespace blus {
             response->set_success(true);
         }
 
-        // RabbitMQ消息回调函数 
-        void onMessage(const std::string& message) {
+        // RabbitMQ批量消息回调函数: 逐条完成文件上传与es索引后，整批一次写入mysql
+        void onMessages(const std::vector<std::string>& messages) {
+            std::vector<Message> rows;
+            rows.reserve(messages.size());
+            for (const auto& message : messages) {
+                auto row = prepare(message);
+                if (row) rows.push_back(std::move(*row));
+            }
+            if (rows.empty()) return;
+            if (_message_table->insert(rows)) return;
+            // 整批失败(如重投递导致的重复message_id)时逐条重试，避免一条坏数据拖垮整批
+            // 分片间的批次相互独立，部分消息可能已经落库，已存在的消息视为成功
+            LOG_WARN("批量持久化{}条消息失败，改为逐条插入", rows.size());
+            for (const auto& row : rows) {
+                if (_message_table->insert(row) || _message_table->select_by_mid(row.message_id())) continue;
+                LOG_ERROR("持久化消息插入mysql失败{}", row.message_id());
+                // 如果是文本消息，则删除es中的索引
+                if (row.message_type() == MessageType::STRING &&
+                    !_es_message->remove(row.message_id())) {
+                    LOG_CRITICAL("持久化消息保持一致性失败{}", row.message_id());
+                }
+            }
+        }
+    private:
+        // 解析一条队列消息，上传文件/写入es，返回待插入mysql的行，失败返回nullptr
+        std::unique_ptr<Message> prepare(const std::string& message) {
             MessageInfo msg;
             if (!msg.ParseFromString(message)) {
                 LOG_ERROR("RabbitMQ消息反系列化失败");
-                return;
+                return nullptr;
             }
             auto put_file = [this](const std::string& file_name, const std::string& data, std::string& file_id) {
-                auto channel = _service_manager->get(_file_service_name);
-                if (!channel) {
+                auto lease = _service_manager->lease(_file_service_name);
+                if (!lease) {
                     LOG_ERROR("没有可用的文件服务节点");
                     return false;
                 }
-                FileService_Stub stub(channel.get());
+                FileService_Stub stub(lease.channel());
                 brpc::Controller cntl;
                 PutSingleFileReq req;
                 PutSingleFileRsp rsp;
@@ -243,7 +352,10 @@ namespace blus {
                 req.mutable_file_data()->set_file_name(file_name);
                 req.mutable_file_data()->set_file_content(data);
                 req.mutable_file_data()->set_file_size(data.size());
+                // 消息持久化来自队列消费，没有上游预算，按默认预算设置超时
+                Deadline().propagate(&cntl, &req);
                 stub.PutSingleFile(&cntl, &req, &rsp, nullptr);
+                lease.release(cntl.Failed());
                 if (cntl.Failed() || rsp.success() == false) {
                     LOG_ERROR("PutSingleFile RPC失败{}: {}", req.request_id(), cntl.Failed() ? cntl.ErrorText() : rsp.errmsg());
                     return false;
@@ -251,11 +363,11 @@ namespace blus {
                 file_id = rsp.file_info().file_id();
                 return true;
                 };
-            Message sql_msg{ msg.message_id(),
+            auto sql_msg = std::make_unique<Message>(msg.message_id(),
                 msg.sender().user_id(),
                 msg.chat_session_id(),
                 static_cast<unsigned char>(msg.message().message_type()),
-                boost::posix_time::from_time_t(msg.timestamp()) };
+                boost::posix_time::from_time_t(msg.timestamp()));
             std::string file_id;
             switch (msg.message().message_type()) {
             case MessageType::STRING:
@@ -266,15 +378,15 @@ namespace blus {
                     boost::posix_time::from_time_t(msg.timestamp()),
                     msg.message().string_message().content())) {
                     LOG_ERROR("持久化消息插入es失败{}", msg.message_id());
-                    return;
+                    return nullptr;
                 }
                 break;
             case MessageType::FILE:
                 put_file(msg.message().file_message().file_name(),
                     msg.message().file_message().file_contents(),
                     file_id);
-                sql_msg.file_name(msg.message().file_message().file_name());
-                sql_msg.file_size(msg.message().file_message().file_size());
+                sql_msg->file_name(msg.message().file_message().file_name());
+                sql_msg->file_size(msg.message().file_message().file_size());
                 break;
             case MessageType::IMAGE:
                 put_file("",
@@ -290,26 +402,33 @@ namespace blus {
                 LOG_CRITICAL("未知消息类型{}", msg.message().message_type());
                 abort();
             }
-            if (msg.message().message_type() == MessageType::STRING) sql_msg.content(msg.message().string_message().content());
-            else sql_msg.file_id(file_id);
-            // 插入mysql
-            if (!_message_table->insert(sql_msg)) {
-                LOG_ERROR("持久化消息插入mysql失败{}", msg.message_id());
-                // 如果是文本消息，则删除es中的索引
-                if (msg.message().message_type() == MessageType::STRING &&
-                    !_es_message->remove(msg.message_id())) {
-                    LOG_CRITICAL("持久化消息保持一致性失败{}", msg.message_id());
+            if (msg.message().message_type() == MessageType::STRING) sql_msg->content(msg.message().string_message().content());
+            else sql_msg->file_id(file_id);
+            return sql_msg;
+        }
+
+        static constexpr int kHistoryPageSize = 50; // 历史消息未指定每页条数时的默认值
+        static constexpr size_t kHistoryBudgetBytes = 4 * 1024 * 1024; // 单页历史消息(含文件内容)的内存上限
+
+        // 按预算截断一页消息: 保留累计大小不超过kHistoryBudgetBytes的前缀(至少一条)，
+        // 有截断时游标改为最后保留的消息，下一页从被截掉的消息继续
+        template <typename SizeOf>
+        static void trim_to_budget(std::vector<Message>& msg_list, std::string& next_cursor, SizeOf size_of) {
+            size_t total = 0;
+            size_t kept = 0;
+            for (; kept < msg_list.size(); ++kept) {
+                total += size_of(msg_list[kept]);
+                if (kept > 0 && total > kHistoryBudgetBytes) {
+                    break;
                 }
             }
-        }
-    private:
-        google::protobuf::Map<std::string, FileDownloadData> _get_files(const std::string& request_id, const std::vector<std::string>& file_ids) {
-            auto channel = _service_manager->get(_file_service_name);
-            if (!channel) {
-                LOG_ERROR("没有可用的文件服务节点");
-                return {};
+            if (kept < msg_list.size()) {
+                msg_list.resize(kept);
+                next_cursor = MessageCursor{ msg_list.back().create_time(), msg_list.back().id() }.encode();
             }
-            FileService_Stub stub(channel.get());
+        }
+
+        google::protobuf::Map<std::string, FileDownloadData> _get_files(const std::string& request_id, const std::vector<std::string>& file_ids, const Deadline& deadline) {
             brpc::Controller cntl;
             GetMultiFileReq req;
             GetMultiFileRsp rsp;
@@ -317,7 +436,11 @@ namespace blus {
             for (const auto& file_id : file_ids) {
                 req.add_file_id_list(file_id);
             }
-            stub.GetMultiFile(&cntl, &req, &rsp, nullptr);
+            if (!deadline.propagate(&cntl, &req)) {
+                LOG_WARN("GetFile 请求已超时{}", request_id);
+                return {};
+            }
+            _service_manager->call(_file_service_name, &FileService_Stub::GetMultiFile, &cntl, &req, &rsp);
             if (cntl.Failed() || rsp.success() == false) {
                 LOG_ERROR("GetFile RPC失败{}: {}", request_id, cntl.Failed() ? cntl.ErrorText() : rsp.errmsg());
                 return {};
@@ -325,21 +448,21 @@ namespace blus {
             return rsp.file_data();
         }
 
-        google::protobuf::Map<std::string, UserInfo> _get_users(const std::string& request_id, const std::vector<std::string>& user_ids) {
-            auto channel = _service_manager->get(_user_service_name);
-            if (!channel) {
-                LOG_ERROR("没有可用的用户服务节点");
-                return {};
-            }
-            UserService_Stub stub(channel.get());
+        google::protobuf::Map<std::string, UserInfo> _get_users(const std::string& request_id, const std::vector<std::string>& user_ids, const Deadline& deadline) {
             brpc::Controller cntl;
             GetMultiUserInfoReq req;
             GetMultiUserInfoRsp rsp;
             req.set_request_id(request_id);
+            // 发送者不带头像内容，客户端按avatar_id单独获取
+            req.set_view(USER_INFO_LITE);
             for (const auto& user_id : user_ids) {
                 req.add_users_id(user_id);
             }
-            stub.GetMultiUserInfo(&cntl, &req, &rsp, nullptr);
+            if (!deadline.propagate(&cntl, &req)) {
+                LOG_WARN("GetUserInfo 请求已超时{}", request_id);
+                return {};
+            }
+            _service_manager->call(_user_service_name, &UserService_Stub::GetMultiUserInfo, &cntl, &req, &rsp);
             if (cntl.Failed() || rsp.success() == false) {
                 LOG_ERROR("GetUserInfo RPC失败{}: {}", request_id, cntl.Failed() ? cntl.ErrorText() : rsp.errmsg());
                 return {};
@@ -348,19 +471,66 @@ namespace blus {
         }
 
         std::shared_ptr<elasticlient::Client> _es;
-        std::shared_ptr<odb::database> _mysql;
+        ShardRouter::Ptr _mysql;
         ESMessage::Ptr _es_message;
         MessageTable::Ptr _message_table;
         std::string _file_service_name;
         std::string _user_service_name;
         ServiceManager::Ptr _service_manager;
+        IOExecutors _io;
+    };
+
+    // 后台归档: 每隔interval_sec把hot_months个月之前的分区从热表移入归档
+    class MessageArchiver {
+    public:
+        using Ptr = std::shared_ptr<MessageArchiver>;
+        // owner为本实例名称，各实例竞争归档租约，同一时间只有一个实例执行归档
+        MessageArchiver(const MessageTable::Ptr& table, const std::string& owner, int hot_months, int interval_sec)
+            : _table(table)
+            , _owner(owner)
+            , _hot_months(std::max(1, hot_months))
+            , _interval(std::chrono::seconds(std::max(1, interval_sec))) {
+            _thread = std::thread([this]() { run(); });
+        }
+        ~MessageArchiver() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cv.notify_all();
+            _thread.join();
+        }
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            do {
+                lock.unlock();
+                // 消息时间由time_t转换而来，为UTC时间
+                auto now = boost::posix_time::second_clock::universal_time();
+                auto cutoff = boost::posix_time::ptime(now.date() - boost::gregorian::months(_hot_months), now.time_of_day());
+                if (!_table->archive(cutoff, _owner)) {
+                    LOG_WARN("消息归档未完成，{}秒后重试", std::chrono::duration_cast<std::chrono::seconds>(_interval).count());
+                }
+                lock.lock();
+            } while (!_cv.wait_for(lock, _interval, [this]() { return _stop; }));
+        }
+
+        MessageTable::Ptr _table;
+        std::string _owner;
+        int _hot_months;
+        std::chrono::steady_clock::duration _interval;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stop = false;
+        std::thread _thread;
     };
 
     class MsgStorageServer {
     public:
         using Ptr = std::shared_ptr<MsgStorageServer>;
-        MsgStorageServer(const Discovery::Ptr& file_dis, const Discovery::Ptr& user_dis, const Registry::Ptr& reg, const std::shared_ptr<brpc::Server>& server)
-            : _file_dis(file_dis), _user_dis(user_dis), _reg(reg), _server(server) {
+        MsgStorageServer(const Discovery::Ptr& file_dis, const Discovery::Ptr& user_dis, const Registry::Ptr& reg, const std::shared_ptr<brpc::Server>& server,
+            const MessageArchiver::Ptr& archiver = nullptr)
+            : _file_dis(file_dis), _user_dis(user_dis), _reg(reg), _server(server), _archiver(archiver) {
         }
         ~MsgStorageServer() {}
 
@@ -371,6 +541,7 @@ namespace blus {
         Discovery::Ptr _file_dis, _user_dis;
         Registry::Ptr _reg;
         std::shared_ptr<brpc::Server> _server;
+        MessageArchiver::Ptr _archiver;
     };
 
     class MsgStorageServerBuilder {
@@ -394,8 +565,54 @@ namespace blus {
             const std::string& sock_path = "",
             int conn_pool_count = 10,
             int port = 3306,
-            const std::string& cset = "utf8") {
-            _mysql = ODBFactory::create(user, pswd, db, host, sock_path, conn_pool_count, port, cset);
+            const std::string& cset = "utf8",
+            const std::string& replicas = "") {
+            _mysql = ODBFactory::create_shards(user, pswd, db, host, sock_path, conn_pool_count, port, cset, replicas);
+            return true;
+        }
+
+        // 关注etcd中的会话分片映射表(可选)，映射表更新后在线切换路由，需在make_mysql之后调用
+        // 不调用时会话数据都在make_mysql配置的库中
+        bool make_shard_map(const std::string& etcd_addr, const std::string& shard_map_key, const std::string& snapshot_dir = "") {
+            if (!_mysql) {
+                LOG_ERROR("mysql服务未设置");
+                return false;
+            }
+            auto shards = _mysql;
+            _shard_dis = std::make_shared<Discovery>(shard_map_key, etcd_addr,
+                [shards](const ServiceDiff& diff) {
+                    for (const auto& [key, value] : diff.online) {
+                        shards->update(value);
+                    }
+                },
+                nullptr, Discovery::snapshot_file(snapshot_dir, shard_map_key));
+            return true;
+        }
+
+        // 设置阻塞I/O执行器(可选)，各后端的线程数<=0时在rpc线程直接执行，需在make_rpc之前调用
+        bool make_io(int mysql_threads, int es_threads, int queue_size) {
+            _io = IOExecutors::create(mysql_threads, es_threads, 0, 0, queue_size);
+            return true;
+        }
+
+        // 设置冷消息归档(可选): 每partition_months个月一个分区，热表保留最近hot_months个月，
+        // 需在make_rpc之前调用
+        // 只有shared(dir为所有实例共享的存储)时才执行归档(导出并从热表删除)，否则只读取已有的归档
+        bool make_archive(const std::string& dir, int partition_months, int hot_months, int interval_sec,
+            bool shared, const std::string& instance_name) {
+            _archive = std::make_shared<MessageArchive>(dir, partition_months);
+            _hot_months = hot_months;
+            _archive_interval_sec = interval_sec;
+            _archive_shared = shared;
+            _instance_name = instance_name;
+            if (!shared) {
+                LOG_WARN("归档目录{}未声明为共享存储, 不执行归档", dir);
+            }
+            else if (instance_name.empty()) {
+                // 实例名称是归档租约的持有者标识，为空时多个实例会同时归档
+                LOG_ERROR("未设置实例名称, 不执行归档");
+                _archive_shared = false;
+            }
             return true;
         }
 
@@ -405,24 +622,31 @@ namespace blus {
             const std::string& instance_name,
             const std::string& service_ip,
             int32_t service_port,
-            int etcd_timeout) {
+            int etcd_timeout,
+            const std::string& snapshot_dir = "") {
             _service_manager = std::make_shared<ServiceManager>();
-            _service_manager->declare(_file_service_name);
-            _service_manager->declare(_user_service_name);
+            // 文件节点磁盘性能差异大，使用耗时感知的P2C策略
+            // 历史消息拉取的文件/用户信息均为幂等读请求，开启对冲以削减长尾
+            HedgeOptions hedge;
+            hedge.enabled = true;
+            _service_manager->declare(_file_service_name, LoadBalancePolicy::P2C, hedge);
+            _service_manager->declare(_user_service_name, LoadBalancePolicy::LEAST_BUSY, hedge);
             _file_dis = std::make_shared<Discovery>(_file_service_name, etcd_addr,
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->online(name, ip);
+                [this](const ServiceDiff& diff) {
+                    _service_manager->apply(diff.online, diff.offline);
                 },
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->offline(name, ip);
-                });
+                [this](const std::string& key, const std::string& load) {
+                    _service_manager->update_load(key, load);
+                },
+                Discovery::snapshot_file(snapshot_dir, _file_service_name));
             _user_dis = std::make_shared<Discovery>(_user_service_name, etcd_addr,
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->online(name, ip);
+                [this](const ServiceDiff& diff) {
+                    _service_manager->apply(diff.online, diff.offline);
                 },
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->offline(name, ip);
-                });
+                [this](const std::string& key, const std::string& load) {
+                    _service_manager->update_load(key, load);
+                },
+                Discovery::snapshot_file(snapshot_dir, _user_service_name));
             _reg = make_shared<Registry>(message_service_name, etcd_addr, etcd_timeout);
             _reg->registry(instance_name, service_ip + ":" + to_string(service_port));
             return true;
@@ -430,11 +654,14 @@ namespace blus {
 
         // 设置rabbitmq服务
         bool make_rabbitmq(const std::string& user, const std::string& password, const std::string& host,
-            const std::string& exchange, const std::string& queue) {
+            const std::string& exchange, const std::string& queue,
+            int consume_batch_size = 64, int consume_batch_delay_ms = 20) {
             _rabbitmq = std::make_shared<RabbitMQ>(user, password, host);
             _rabbitmq->declareComponents(exchange, queue);
             _exchange_name = exchange;
             _queue_name = queue;
+            _consume_batch_size = consume_batch_size;
+            _consume_batch_delay_ms = consume_batch_delay_ms;
             return true;
         }
 
@@ -442,7 +669,7 @@ namespace blus {
         bool make_rpc(int32_t listen_port, uint8_t thread_num, int rpc_timeout) {
             _server = make_shared<brpc::Server>();
 
-            auto service = new MsgStorageServiceImpl(_es, _mysql, _file_service_name, _user_service_name, _service_manager);
+            auto service = new MsgStorageServiceImpl(_es, _mysql, _archive, _file_service_name, _user_service_name, _service_manager, _io);
             int ret = _server->AddService(service, brpc::SERVER_OWNS_SERVICE);
             if (ret != 0) {
                 LOG_ERROR("MsgStorageServer添加服务失败");
@@ -458,8 +685,9 @@ namespace blus {
                 LOG_ERROR("MsgStorageServer启动失败");
                 return false;
             }
-            _rabbitmq->consume(_queue_name, [service](const std::string& message) {
-                service->onMessage(message);
+            _rabbitmq->consume_batch(_queue_name, _consume_batch_size, _consume_batch_delay_ms,
+                [service](const std::vector<std::string>& messages) {
+                    service->onMessages(messages);
                 });
             return true;
         }
@@ -485,18 +713,39 @@ namespace blus {
                 LOG_ERROR("rpc服务未设置");
                 return nullptr;
             }
-            return make_shared<MsgStorageServer>(_file_dis, _user_dis, _reg, _server);
+            // 已有消息移入归档时，未配置归档的实例读不到水位之前的消息
+            boost::posix_time::ptime horizon;
+            if (!_archive && MessageTable(_mysql).shared_horizon(horizon) &&
+                horizon != boost::posix_time::ptime(boost::posix_time::min_date_time)) {
+                LOG_ERROR("{}之前的消息已移入归档, 需配置归档目录", boost::posix_time::to_simple_string(horizon));
+                return nullptr;
+            }
+            MessageArchiver::Ptr archiver;
+            if (_archive && _archive_shared) {
+                archiver = std::make_shared<MessageArchiver>(std::make_shared<MessageTable>(_mysql, _archive),
+                    _instance_name, _hot_months, _archive_interval_sec);
+            }
+            return make_shared<MsgStorageServer>(_file_dis, _user_dis, _reg, _server, archiver);
         }
     private:
         Registry::Ptr _reg;
         std::shared_ptr<elasticlient::Client> _es;
-        std::shared_ptr<odb::database> _mysql;
+        ShardRouter::Ptr _mysql;
+        Discovery::Ptr _shard_dis;
+        MessageArchive::Ptr _archive;
+        int _hot_months = 3;
+        int _archive_interval_sec = 3600;
+        bool _archive_shared = false;
+        std::string _instance_name;
         RabbitMQ::Ptr _rabbitmq;
         ServiceManager::Ptr _service_manager;
         std::string _file_service_name;
         std::string _user_service_name;
         std::string _exchange_name;
         std::string _queue_name;
+        int _consume_batch_size = 64;
+        int _consume_batch_delay_ms = 20;
+        IOExecutors _io;
         Discovery::Ptr _file_dis, _user_dis;
         std::shared_ptr<brpc::Server> _server;
     };
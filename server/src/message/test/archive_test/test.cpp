@@ -0,0 +1,102 @@
+#include "message_archive.hpp"
+#include "logger.hpp"
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+DEFINE_string(log_file, "", "日志文件路径, 默认输出到控制台");
+DEFINE_int32(log_level, 0, "日志等级, 0: trace, 1: debug, 2: info, 3: warn, 4: error, 5: critical");
+DEFINE_string(archive_dir, "./archive_test_data", "测试使用的归档目录, 测试开始时清空");
+
+static boost::posix_time::ptime t(const char* s) {
+    return boost::posix_time::time_from_string(s);
+}
+
+static blus::Message make(const std::string& mid, const std::string& ssid, unsigned long id, boost::posix_time::ptime time) {
+    blus::Message m{ mid, "user1", ssid, 0, time };
+    m.id(id);
+    m.content("content " + mid);
+    return m;
+}
+
+TEST(MessageArchive, partition) {
+    blus::MessageArchive monthly(FLAGS_archive_dir, 1);
+    EXPECT_EQ(monthly.partition_start(t("2023-10-15 01:00:00")), t("2023-10-01 00:00:00"));
+    EXPECT_EQ(monthly.next_partition(t("2023-12-01 00:00:00")), t("2024-01-01 00:00:00"));
+    blus::MessageArchive quarterly(FLAGS_archive_dir, 3);
+    EXPECT_EQ(quarterly.partition_start(t("2023-11-15 01:00:00")), t("2023-10-01 00:00:00"));
+    EXPECT_EQ(quarterly.next_partition(t("2023-10-01 00:00:00")), t("2024-01-01 00:00:00"));
+}
+
+TEST(MessageArchive, append_read) {
+    {
+        blus::MessageArchive archive(FLAGS_archive_dir, 1);
+        // 共享目录上的另一个实例，先于归档打开
+        blus::MessageArchive other(FLAGS_archive_dir, 1);
+        std::vector<blus::Message> october;
+        for (int i = 0; i < 2500; ++i) {
+            october.push_back(make("m" + std::to_string(i), "s1", i + 1, t("2023-10-01 00:00:00") + boost::posix_time::seconds(i)));
+        }
+        blus::Message file{ "f", "user1", "s2", 2, t("2023-10-03 00:00:00") };
+        file.id(9999);
+        file.file_id("fid");
+        file.file_name("a.txt");
+        file.file_size(5);
+        october.push_back(file);
+        ASSERT_TRUE(archive.append(t("2023-10-01 00:00:00"), october));
+        // 重复归档的消息读取时去重
+        ASSERT_TRUE(archive.append(t("2023-10-01 00:00:00"), { october[5] }));
+        std::vector<blus::Message> november;
+        for (int i = 0; i < 10; ++i) {
+            november.push_back(make("n" + std::to_string(i), "s1", 10000 + i, t("2023-11-02 00:00:00") + boost::posix_time::seconds(i)));
+        }
+        ASSERT_TRUE(archive.append(t("2023-11-01 00:00:00"), november));
+        EXPECT_EQ(archive.horizon(), boost::posix_time::ptime(boost::posix_time::min_date_time));
+        archive.set_horizon(t("2023-12-01 00:00:00"));
+        archive.set_horizon(t("2023-11-01 00:00:00"));
+        EXPECT_EQ(archive.horizon(), t("2023-12-01 00:00:00"));
+        // 水位推进后读到其他实例新归档的分区
+        EXPECT_TRUE(other.read("s1", t("2023-11-01 00:00:00"), t("2023-12-01 00:00:00")).empty());
+        other.set_horizon(t("2023-12-01 00:00:00"));
+        EXPECT_EQ(other.read("s1", t("2023-11-01 00:00:00"), t("2023-12-01 00:00:00")).size(), 10);
+    }
+    // 水位以数据库为准，不保存在归档目录
+    blus::MessageArchive archive(FLAGS_archive_dir, 1);
+    EXPECT_EQ(archive.horizon(), boost::posix_time::ptime(boost::posix_time::min_date_time));
+
+    auto messages = archive.read("s1", t("2023-10-01 00:00:00"), t("2023-10-01 00:00:20"));
+    ASSERT_EQ(messages.size(), 21);
+    EXPECT_EQ(messages[5].message_id(), "m5");
+    EXPECT_EQ(messages[10].content(), "content m10");
+
+    messages = archive.read("s2", t("2023-01-01 00:00:00"), t("2024-01-01 00:00:00"));
+    ASSERT_EQ(messages.size(), 1);
+    EXPECT_EQ(messages[0].id(), 9999);
+    EXPECT_EQ(messages[0].file_name(), "a.txt");
+    EXPECT_EQ(messages[0].file_size(), 5);
+
+    // 跨分区向前翻页
+    messages = archive.read_before("s1", t("2023-12-01 00:00:00"), 0, 15);
+    ASSERT_EQ(messages.size(), 15);
+    EXPECT_EQ(messages.front().message_id(), "m2495");
+    EXPECT_EQ(messages.back().message_id(), "n9");
+    messages = archive.read_before("s1", t("2023-10-01 00:00:05"), 0, 100);
+    ASSERT_EQ(messages.size(), 5);
+    EXPECT_EQ(messages.back().message_id(), "m4");
+
+    // 跨分区向后翻页
+    messages = archive.read_after("s1", t("2023-10-01 00:41:35"), 2496, t("2023-12-01 00:00:00"), 6);
+    ASSERT_EQ(messages.size(), 6);
+    EXPECT_EQ(messages[0].message_id(), "m2496");
+    EXPECT_EQ(messages[4].message_id(), "n0");
+
+    EXPECT_TRUE(archive.read("s3", t("2023-01-01 00:00:00"), t("2024-01-01 00:00:00")).empty());
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
+    std::filesystem::remove_all(FLAGS_archive_dir);
+
+    return RUN_ALL_TESTS();
+}
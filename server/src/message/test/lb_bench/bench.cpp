@@ -0,0 +1,122 @@
+// 负载均衡策略压测: 模拟性能不一致的后端节点，比较不同策略下的尾延迟
+// 不依赖真实服务，brpc::Channel::Init 不会立即建立连接
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sstream>
+
+#include "channel.hpp"
+#include "logger.hpp"
+
+DEFINE_string(log_file, "", "日志文件路径, 默认输出到控制台");
+DEFINE_int32(log_level, 3, "日志等级, 0: trace, 1: debug, 2: info, 3: warn, 4: error, 5: critical");
+DEFINE_string(backend_latency_us, "1000,1000,1000,1000,8000", "各后端节点单请求基准耗时(微秒), 逗号分隔");
+DEFINE_int32(backend_capacity, 4, "每个后端节点可并行处理的请求数, 超出后耗时线性增长");
+DEFINE_int32(threads, 16, "并发客户端线程数");
+DEFINE_int32(requests, 2000, "每个线程发起的请求数");
+
+struct Backend {
+    int64_t base_us;
+    std::atomic<int> inflight{ 0 };
+    std::atomic<int64_t> served{ 0 };
+};
+
+struct Result {
+    std::vector<int64_t> latencies;
+    std::vector<int64_t> served;
+};
+
+Result run(blus::LoadBalancePolicy policy, const std::vector<int64_t>& base_latency) {
+    auto channel = std::make_shared<blus::ServiceChannel>("bench", policy);
+    std::unordered_map<std::string, std::unique_ptr<Backend>> backends;
+    std::vector<std::string> addrs;
+    for (size_t i = 0; i < base_latency.size(); ++i) {
+        std::string addr = "127.0.0.1:" + std::to_string(20000 + i);
+        auto backend = std::make_unique<Backend>();
+        backend->base_us = base_latency[i];
+        backends.emplace(addr, std::move(backend));
+        addrs.push_back(addr);
+        channel->append(addr);
+    }
+
+    std::vector<std::vector<int64_t>> per_thread(FLAGS_threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < FLAGS_threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::exponential_distribution<double> jitter(1.0);
+            auto& samples = per_thread[t];
+            samples.reserve(FLAGS_requests);
+            for (int i = 0; i < FLAGS_requests; ++i) {
+                auto begin = std::chrono::steady_clock::now();
+                auto lease = channel->acquire();
+                auto& backend = *backends.at(lease.ip_port());
+                int inflight = backend.inflight.fetch_add(1) + 1;
+                // 超出并行能力后排队，耗时按排队倍数增长
+                double factor = std::max(1.0, static_cast<double>(inflight) / FLAGS_backend_capacity);
+                auto cost = static_cast<int64_t>(backend.base_us * factor * (0.5 + 0.5 * jitter(rng)));
+                std::this_thread::sleep_for(std::chrono::microseconds(cost));
+                backend.inflight.fetch_sub(1);
+                backend.served.fetch_add(1);
+                lease.release();
+                samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - begin).count());
+            }
+            });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    Result result;
+    for (auto& samples : per_thread) {
+        result.latencies.insert(result.latencies.end(), samples.begin(), samples.end());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    for (const auto& addr : addrs) {
+        result.served.push_back(backends.at(addr)->served.load());
+    }
+    return result;
+}
+
+int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[index];
+}
+
+void report(const std::string& name, const Result& result) {
+    std::cout << name
+        << " p50=" << percentile(result.latencies, 0.5) << "us"
+        << " p90=" << percentile(result.latencies, 0.9) << "us"
+        << " p99=" << percentile(result.latencies, 0.99) << "us"
+        << " p999=" << percentile(result.latencies, 0.999) << "us"
+        << " served=[";
+    for (size_t i = 0; i < result.served.size(); ++i) {
+        std::cout << (i ? "," : "") << result.served[i];
+    }
+    std::cout << "]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
+
+    std::vector<int64_t> base_latency;
+    std::stringstream ss(FLAGS_backend_latency_us);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        base_latency.push_back(std::stoll(item));
+    }
+    if (base_latency.empty()) {
+        std::cout << "未指定后端节点" << std::endl;
+        return 1;
+    }
+
+    report("least_busy", run(blus::LoadBalancePolicy::LEAST_BUSY, base_latency));
+    report("p2c       ", run(blus::LoadBalancePolicy::P2C, base_latency));
+    return 0;
+}
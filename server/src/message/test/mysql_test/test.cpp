@@ -83,6 +83,157 @@ TEST_F(MessageTableTest, remove) {
     EXPECT_EQ(messages.size(), 0);
 }
 
+TEST_F(MessageTableTest, page) {
+    // m3与m4创建时间相同，由_id区分先后
+    auto t = [](const char* s) { return boost::posix_time::time_from_string(s); };
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "p1", "user1", "page", 0, t("2023-10-01 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "p2", "user1", "page", 0, t("2023-10-02 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "p3", "user1", "page", 0, t("2023-10-03 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "p4", "user1", "page", 0, t("2023-10-03 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "p5", "user1", "page", 0, t("2023-10-05 12:00:00") }));
+
+    std::string next;
+    auto messages = g_message_table->get_page("page", nullptr, 2, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "p4");
+    EXPECT_EQ(messages[1].message_id(), "p5");
+    ASSERT_FALSE(next.empty());
+
+    blus::MessageCursor cursor;
+    ASSERT_TRUE(blus::MessageCursor::decode(next, cursor));
+    messages = g_message_table->get_page("page", &cursor, 2, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "p2");
+    EXPECT_EQ(messages[1].message_id(), "p3");
+
+    ASSERT_TRUE(blus::MessageCursor::decode(next, cursor));
+    messages = g_message_table->get_page("page", &cursor, 2, next);
+    ASSERT_EQ(messages.size(), 1);
+    EXPECT_EQ(messages[0].message_id(), "p1");
+    EXPECT_TRUE(next.empty());
+
+    // 按时间点取之前的消息
+    cursor = blus::MessageCursor::before(t("2023-10-03 12:00:00"));
+    messages = g_message_table->get_page("page", &cursor, 10, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[1].message_id(), "p2");
+
+    EXPECT_FALSE(blus::MessageCursor::decode("bad", cursor));
+    EXPECT_FALSE(blus::MessageCursor::decode("12-", cursor));
+    EXPECT_TRUE(g_message_table->remove("page"));
+}
+
+TEST_F(MessageTableTest, range_page) {
+    auto t = [](const char* s) { return boost::posix_time::time_from_string(s); };
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "r1", "user1", "range", 0, t("2023-10-01 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "r2", "user1", "range", 0, t("2023-10-02 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "r3", "user1", "range", 0, t("2023-10-02 12:00:00") }));
+    EXPECT_TRUE(g_message_table->insert(blus::Message{ "r4", "user1", "range", 0, t("2023-10-09 12:00:00") }));
+
+    std::string next;
+    auto start = t("2023-10-01 00:00:00"), end = t("2023-10-05 00:00:00");
+    auto messages = g_message_table->get_range_page("range", start, end, nullptr, 2, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "r1");
+    EXPECT_EQ(messages[1].message_id(), "r2");
+    blus::MessageCursor cursor;
+    ASSERT_TRUE(blus::MessageCursor::decode(next, cursor));
+    messages = g_message_table->get_range_page("range", start, end, &cursor, 2, next);
+    ASSERT_EQ(messages.size(), 1);
+    EXPECT_EQ(messages[0].message_id(), "r3");
+    EXPECT_TRUE(next.empty());
+    EXPECT_TRUE(g_message_table->remove("range"));
+}
+
+TEST_F(MessageTableTest, batch_insert) {
+    auto t = [](const char* s) { return boost::posix_time::time_from_string(s); };
+    std::vector<blus::Message> batch;
+    for (int i = 0; i < 600; ++i) {
+        blus::Message m{ "b" + std::to_string(i), "user1", "batch", 0, t("2023-10-01 12:00:00") + boost::posix_time::seconds(i) };
+        m.content("it's \"batch\" #" + std::to_string(i));
+        batch.push_back(m);
+    }
+    blus::Message file{ "bf", "user1", "batch", 2, t("2023-10-02 12:00:00") };
+    file.file_id("fid");
+    file.file_name("a.txt");
+    file.file_size(12);
+    batch.push_back(file);
+    EXPECT_TRUE(g_message_table->insert(batch));
+
+    auto m = g_message_table->select_by_mid("b7");
+    ASSERT_TRUE(m);
+    EXPECT_EQ(m->content(), "it's \"batch\" #7");
+    EXPECT_EQ(m->create_time(), t("2023-10-01 12:00:07"));
+    m = g_message_table->select_by_mid("bf");
+    ASSERT_TRUE(m);
+    EXPECT_EQ(m->file_name(), "a.txt");
+    EXPECT_EQ(m->file_size(), 12);
+    EXPECT_EQ(m->content(), "");
+
+    // 重复message_id使整批回滚
+    std::vector<blus::Message> dup{ blus::Message{ "b_new", "user1", "batch", 0, t("2023-10-03 12:00:00") }, batch[0] };
+    EXPECT_FALSE(g_message_table->insert(dup));
+    EXPECT_FALSE(g_message_table->select_by_mid("b_new"));
+    EXPECT_TRUE(g_message_table->remove("batch"));
+}
+
+TEST_F(MessageTableTest, archive) {
+    auto t = [](const char* s) { return boost::posix_time::time_from_string(s); };
+    std::filesystem::remove_all("./message_archive_test");
+    auto archive = std::make_shared<blus::MessageArchive>("./message_archive_test", 1);
+    blus::MessageTable table(std::make_shared<blus::DBRouter>(g_db), archive);
+    ASSERT_TRUE(table.clear());
+    EXPECT_TRUE(table.insert(blus::Message{ "a1", "user1", "archive", 0, t("2023-08-10 12:00:00") }));
+    EXPECT_TRUE(table.insert(blus::Message{ "a2", "user1", "archive", 0, t("2023-09-10 12:00:00") }));
+    EXPECT_TRUE(table.insert(blus::Message{ "a3", "user1", "archive", 0, t("2023-09-20 12:00:00") }));
+    EXPECT_TRUE(table.insert(blus::Message{ "a4", "user1", "archive", 0, t("2023-10-10 12:00:00") }));
+
+    // 10月之前的两个分区移入归档，热表只剩a4
+    ASSERT_TRUE(table.archive(t("2023-10-15 00:00:00"), "instance1"));
+    EXPECT_EQ(archive->horizon(), t("2023-10-01 00:00:00"));
+    boost::posix_time::ptime horizon;
+    ASSERT_TRUE(table.shared_horizon(horizon));
+    EXPECT_EQ(horizon, t("2023-10-01 00:00:00"));
+    EXPECT_EQ(g_message_table->get_recent("archive", 10).size(), 1);
+    // 租约有效期内其他实例不执行归档(a0早于水位，在归档前对读取不可见)
+    EXPECT_TRUE(table.insert(blus::Message{ "a0", "user1", "archive", 0, t("2023-07-10 12:00:00") }));
+    EXPECT_TRUE(table.archive(t("2023-10-15 00:00:00"), "instance2"));
+    EXPECT_EQ(g_message_table->get_recent("archive", 10).size(), 2);
+
+    // 读取跨越热表与归档
+    std::string next;
+    auto messages = table.get_page("archive", nullptr, 2, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "a3");
+    EXPECT_EQ(messages[1].message_id(), "a4");
+    blus::MessageCursor cursor;
+    ASSERT_TRUE(blus::MessageCursor::decode(next, cursor));
+    messages = table.get_page("archive", &cursor, 2, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "a1");
+    EXPECT_TRUE(next.empty());
+
+    auto start = t("2023-09-01 00:00:00"), end = t("2023-12-01 00:00:00");
+    messages = table.get_range_page("archive", start, end, nullptr, 1, next);
+    ASSERT_EQ(messages.size(), 1);
+    EXPECT_EQ(messages[0].message_id(), "a2");
+    ASSERT_TRUE(blus::MessageCursor::decode(next, cursor));
+    messages = table.get_range_page("archive", start, end, &cursor, 5, next);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].message_id(), "a3");
+    EXPECT_EQ(messages[1].message_id(), "a4");
+    EXPECT_TRUE(next.empty());
+    EXPECT_EQ(table.get_range("archive", start, end).size(), 3);
+
+    // 租约持有者续约后归档a0
+    EXPECT_TRUE(table.archive(t("2023-10-15 00:00:00"), "instance1"));
+    EXPECT_EQ(g_message_table->get_recent("archive", 10).size(), 1);
+    EXPECT_EQ(table.get_range("archive", t("2023-07-01 00:00:00"), t("2023-08-01 00:00:00")).size(), 1);
+    // 没有可归档的分区时直接返回
+    EXPECT_TRUE(table.archive(t("2023-10-15 00:00:00"), "instance1"));
+    EXPECT_TRUE(table.remove("archive"));
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     gflags::ParseCommandLineFlags(&argc, &argv, true);
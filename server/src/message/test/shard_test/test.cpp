@@ -0,0 +1,54 @@
+#include "shard.hpp"
+#include "logger.hpp"
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+DEFINE_string(log_file, "", "日志文件路径, 默认输出到控制台");
+DEFINE_int32(log_level, 0, "日志等级, 0: trace, 1: debug, 2: info, 3: warn, 4: error, 5: critical");
+
+TEST(ShardMap, slot) {
+    // 槽只由会话ID决定，各实例一致
+    EXPECT_EQ(blus::ShardMap::slot_of("session-1"), blus::ShardMap::slot_of("session-1"));
+    for (int i = 0; i < 1000; ++i) {
+        int slot = blus::ShardMap::slot_of("session-" + std::to_string(i));
+        EXPECT_GE(slot, 0);
+        EXPECT_LT(slot, blus::ShardMap::kSlots);
+    }
+    auto map = blus::ShardMap::single("default");
+    EXPECT_EQ(map.owner[blus::ShardMap::slot_of("session-1")], 0);
+    EXPECT_EQ(map.moving_from[blus::ShardMap::slot_of("session-1")], -1);
+}
+
+TEST(ShardMap, parse) {
+    blus::ShardMap map;
+    ASSERT_TRUE(blus::ShardMap::parse(R"({"version": 2, "shards": ["default", "10.0.0.2:3306"],
+        "ranges": [{"from": 0, "to": 511, "shard": 0}, {"from": 512, "to": 1023, "shard": 1, "moving_from": 0}]})", map));
+    EXPECT_EQ(map.version, 2);
+    ASSERT_EQ(map.shards.size(), 2);
+    EXPECT_EQ(map.shards[1], "10.0.0.2:3306");
+    EXPECT_EQ(map.owner[511], 0);
+    EXPECT_EQ(map.moving_from[511], -1);
+    EXPECT_EQ(map.owner[512], 1);
+    EXPECT_EQ(map.moving_from[512], 0);
+
+    // 解析失败时不修改原映射表
+    EXPECT_FALSE(blus::ShardMap::parse("not json", map));
+    // 有槽未分配
+    EXPECT_FALSE(blus::ShardMap::parse(R"({"version": 3, "shards": ["default"],
+        "ranges": [{"from": 0, "to": 511, "shard": 0}]})", map));
+    // 槽重复分配
+    EXPECT_FALSE(blus::ShardMap::parse(R"({"version": 3, "shards": ["default"],
+        "ranges": [{"from": 0, "to": 600, "shard": 0}, {"from": 500, "to": 1023, "shard": 0}]})", map));
+    // 分片下标越界
+    EXPECT_FALSE(blus::ShardMap::parse(R"({"version": 3, "shards": ["default"],
+        "ranges": [{"from": 0, "to": 1023, "shard": 1}]})", map));
+    EXPECT_EQ(map.version, 2);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
+
+    return RUN_ALL_TESTS();
+}
@@ -12,6 +12,8 @@ DEFINE_string(mysql_host, "localhost", "mysql服务器地址");
 DEFINE_int32(mysql_port, 3306, "mysql服务器端口");
 DEFINE_int32(mysql_conn_pool_count, 10, "mysql连接池大小");
 DEFINE_string(mysql_socket, "", "mysql socket路径");
+DEFINE_string(mysql_replicas, "", "mysql只读从库地址, 逗号分隔的host:port, 为空时读写都走主库");
+DEFINE_string(mysql_shard_map_key, "", "etcd中会话分片映射表的key, 为空时不分片");
 
 DEFINE_string(etcd_address, "", "etcd注册中心地址");
 DEFINE_string(user_service_name, "", "用户服务名称");
@@ -20,6 +22,7 @@ DEFINE_string(instance_name, "", "实例名称");
 DEFINE_string(service_ip, "", "实例供外部访问的ip");
 DEFINE_int32(service_port, 0, "服务端口");
 DEFINE_int32(etcd_timeout, 3, "ttl");
+DEFINE_string(discovery_snapshot_dir, "", "服务发现快照目录, 启动时先按快照提供服务再与etcd核对, 为空时不使用");
 
 DEFINE_string(rabbitmq_host, "127.0.0.1:5672", "RabbitMQ 服务器地址, 带端口");
 DEFINE_string(rabbitmq_user, "root", "RabbitMQ 用户名");
@@ -27,9 +30,16 @@ DEFINE_string(rabbitmq_password, "", "RabbitMQ 密码");
 DEFINE_string(rabbitmq_msg_exchange, "", "RabbitMQ 交换机名称");
 DEFINE_string(rabbitmq_msg_queue, "", "RabbitMQ 队列名称");
 
+DEFINE_int32(member_cache_ttl_sec, 0, "会话成员缓存有效期(秒), 0表示不缓存; 仅在修改会话成员的服务发布成员变更事件时开启");
+DEFINE_int32(member_cache_max_sessions, 65536, "会话成员缓存的最大会话数");
+DEFINE_int32(profile_cache_ttl_sec, 300, "发送者资料缓存有效期(秒), 0表示不缓存; user服务未发布资料变更事件时应设为0");
+DEFINE_int32(profile_cache_max_users, 262144, "发送者资料缓存的最大用户数");
+
 DEFINE_int32(listen_port, 7070, "Rpc监听端口");
 DEFINE_int32(rpc_timeout, -1, "Rpc超时时间");
 DEFINE_int32(rpc_threads, 1, "Rpc线程数");
+DEFINE_int32(io_mysql_threads, 8, "执行mysql阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_queue_size, 256, "每个后端阻塞调用的最大排队数, 超出时直接返回服务繁忙");
 
 int main(int argc, char* argv[]) {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -37,9 +47,19 @@ int main(int argc, char* argv[]) {
     blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
 
     blus::TransmitServerBuilder builder{ FLAGS_user_service_name };
-    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8");
-    builder.make_etcd(FLAGS_etcd_address, FLAGS_transmit_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout);
+    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8", FLAGS_mysql_replicas);
+    builder.make_io(FLAGS_io_mysql_threads, FLAGS_io_queue_size);
+    if (!FLAGS_mysql_shard_map_key.empty()) {
+        builder.make_shard_map(FLAGS_etcd_address, FLAGS_mysql_shard_map_key, FLAGS_discovery_snapshot_dir);
+    }
+    builder.make_etcd(FLAGS_etcd_address, FLAGS_transmit_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout, FLAGS_discovery_snapshot_dir);
     builder.make_rabbitmq(FLAGS_rabbitmq_user, FLAGS_rabbitmq_password, FLAGS_rabbitmq_host, FLAGS_rabbitmq_msg_exchange, FLAGS_rabbitmq_msg_queue);
+    if (FLAGS_member_cache_ttl_sec > 0) {
+        builder.make_member_cache(FLAGS_member_cache_ttl_sec, FLAGS_member_cache_max_sessions, FLAGS_instance_name);
+    }
+    if (FLAGS_profile_cache_ttl_sec > 0) {
+        builder.make_profile_cache(FLAGS_profile_cache_ttl_sec, FLAGS_profile_cache_max_users, FLAGS_instance_name);
+    }
     builder.make_rpc(FLAGS_listen_port, FLAGS_rpc_threads, FLAGS_rpc_timeout);
     auto server = builder.build();
     if (server) {
@@ -10,27 +10,43 @@
 
 #include "etcd.hpp"
 #include "channel.hpp"
+#include "deadline.hpp"
 #include "data_mysql.hpp"
 #include "rabbitmq.hpp"
+#include "io_executor.hpp"
+#include "membership_cache.hpp"
+#include "ttl_cache.hpp"
+#include "change_events.hpp"
 #include "logger.hpp"
 #include "utils.hpp"
 
 namespace blus {
+    // 发送者资料缓存，以用户ID为key
+    using ProfileCache = TtlCache<UserInfo>;
+    // 资料失效后重新加载走主库的时长，覆盖user服务从库允许的最大复制延迟及延迟探测误差
+    inline constexpr int kProfileFreshSec = DBRouter::kMaxLagSec * 2;
+
     class MsgTransmitServiceImpl : public MsgTransmitService {
     public:
-        MsgTransmitServiceImpl(const std::shared_ptr<odb::database>& mysql,
+        MsgTransmitServiceImpl(const ShardRouter::Ptr& mysql,
             const std::string& user_service_name,
             const ServiceManager::Ptr& sm,
             const Discovery::Ptr& discovery,
             const RabbitMQ::Ptr& rabbitmq,
             const std::string& exchange_name,
-            const std::string& queue_name)
+            const std::string& queue_name,
+            const IOExecutors& io = {},
+            const MembershipCache::Ptr& member_cache = nullptr,
+            const std::shared_ptr<ProfileCache>& profile_cache = nullptr)
             : _user_service_name(user_service_name)
             , _service_manager(sm)
             , _csm_table(std::make_shared<ChatSessionMemberTable>(mysql))
             , _rabbitmq(rabbitmq)
             , _exchange_name(exchange_name)
-            , _queue_name(queue_name) {
+            , _queue_name(queue_name)
+            , _io(io)
+            , _member_cache(member_cache)
+            , _profile_cache(profile_cache) {
         }
         ~MsgTransmitServiceImpl() {}
 
@@ -44,35 +60,51 @@ namespace blus {
             std::string uid = request->user_id();
             std::string chat_ssid = request->chat_session_id();
             const auto& content = request->message();
-            auto channel = _service_manager->get(_user_service_name);
-            if (!channel) {
-                LOG_ERROR("{}-{} 获取user服务失败", request->request_id(), uid);
-                response->set_errmsg("获取user服务失败");
-                response->set_success(false);
-                return;
-            }
-            blus::UserService_Stub stub(channel.get());
-            brpc::Controller cntl;
-            GetUserInfoReq req;
-            GetUserInfoRsp rsp;
-            req.set_request_id(request->request_id());
-            req.set_user_id(uid);
-            stub.GetUserInfo(&cntl, &req, &rsp, nullptr);
-            if (cntl.Failed() || rsp.success() == false) {
-                LOG_ERROR("{}-{} user服务调用失败: {}", request->request_id(), uid, cntl.ErrorText());
-                response->set_errmsg("user服务调用失败");
-                response->set_success(false);
-                return;
-            }
-            // LOG_DEBUG("{}-{} user服务调用成功", request->request_id(), uid);
+            auto deadline = Deadline::from(*request);
             MessageInfo message;
+            // 缓存命中时不再调用user服务
+            if (!_profile_cache || !_profile_cache->get(uid, *message.mutable_sender())) {
+                uint64_t token = _profile_cache ? _profile_cache->token(uid) : 0;
+                brpc::Controller cntl;
+                GetUserInfoReq req;
+                GetUserInfoRsp rsp;
+                req.set_request_id(request->request_id());
+                req.set_user_id(uid);
+                // 发送者不带头像内容，客户端按avatar_id单独获取
+                req.set_view(USER_INFO_LITE);
+                // 资料刚变更过: 处理请求的user实例可能不是写入的实例，要求读主库，避免把从库的旧资料缓存一个有效期
+                req.set_fresh(_profile_cache && _profile_cache->fresh_required(uid));
+                if (!deadline.propagate(&cntl, &req)) {
+                    LOG_WARN("{}-{} 请求已超时，放弃处理", request->request_id(), uid);
+                    response->set_errmsg("请求已超时");
+                    response->set_success(false);
+                    return;
+                }
+                _service_manager->call(_user_service_name, &UserService_Stub::GetUserInfo, &cntl, &req, &rsp);
+                if (cntl.Failed() || rsp.success() == false) {
+                    LOG_ERROR("{}-{} user服务调用失败: {}", request->request_id(), uid, cntl.ErrorText());
+                    response->set_errmsg("user服务调用失败");
+                    response->set_success(false);
+                    return;
+                }
+                // LOG_DEBUG("{}-{} user服务调用成功", request->request_id(), uid);
+                message.mutable_sender()->Swap(rsp.mutable_user_info());
+                if (_profile_cache) {
+                    _profile_cache->put(uid, message.sender(), token);
+                }
+            }
             message.set_message_id(uuid());
             message.set_chat_session_id(chat_ssid);
             message.set_timestamp(time(nullptr));
-            message.mutable_sender()->CopyFrom(rsp.user_info());
             message.mutable_message()->CopyFrom(content);
             // 获取转发客户端用户列表
-            auto targets = _csm_table->get_members(chat_ssid);
+            std::vector<std::string> targets;
+            auto load = [&](std::vector<std::string>& members) {
+                return offload(_io.mysql, response, [&] { members = _csm_table->get_members(chat_ssid); });
+            };
+            if (!(_member_cache ? _member_cache->get(chat_ssid, targets, load) : load(targets))) {
+                return;
+            }
             // 消息持久化
             if (!_rabbitmq->publish(_exchange_name, _queue_name, message.SerializeAsString())) {
                 LOG_ERROR("{}-{} 消息持久化失败", request->request_id(), uid);
@@ -93,6 +125,9 @@ namespace blus {
         RabbitMQ::Ptr _rabbitmq;
         std::string _exchange_name;
         std::string _queue_name;
+        IOExecutors _io;
+        MembershipCache::Ptr _member_cache;
+        std::shared_ptr<ProfileCache> _profile_cache;
     };
 
     class TransmitServer {
@@ -132,8 +167,33 @@ namespace blus {
             const std::string& sock_path = "",
             int conn_pool_count = 10,
             int port = 3306,
-            const std::string& cset = "utf8") {
-            _mysql = ODBFactory::create(user, pswd, db, host, sock_path, conn_pool_count, port, cset);
+            const std::string& cset = "utf8",
+            const std::string& replicas = "") {
+            _mysql = ODBFactory::create_shards(user, pswd, db, host, sock_path, conn_pool_count, port, cset, replicas);
+            return true;
+        }
+
+        // 关注etcd中的会话分片映射表(可选)，映射表更新后在线切换路由，需在make_mysql之后调用
+        // 不调用时会话数据都在make_mysql配置的库中
+        bool make_shard_map(const std::string& etcd_addr, const std::string& shard_map_key, const std::string& snapshot_dir = "") {
+            if (!_mysql) {
+                LOG_ERROR("mysql服务未设置");
+                return false;
+            }
+            auto shards = _mysql;
+            _shard_dis = std::make_shared<Discovery>(shard_map_key, etcd_addr,
+                [shards](const ServiceDiff& diff) {
+                    for (const auto& [key, value] : diff.online) {
+                        shards->update(value);
+                    }
+                },
+                nullptr, Discovery::snapshot_file(snapshot_dir, shard_map_key));
+            return true;
+        }
+
+        // 设置阻塞I/O执行器(可选)，mysql_threads<=0时在rpc线程直接执行，需在make_rpc之前调用
+        bool make_io(int mysql_threads, int queue_size) {
+            _io = IOExecutors::create(mysql_threads, 0, 0, 0, queue_size);
             return true;
         }
 
@@ -143,16 +203,21 @@ namespace blus {
             const std::string& instance_name,
             const std::string& service_ip,
             int32_t service_port,
-            int etcd_timeout) {
+            int etcd_timeout,
+            const std::string& snapshot_dir = "") {
             _service_manager = std::make_shared<ServiceManager>();
-            _service_manager->declare(_user_service_name);
+            // 获取发送者信息为幂等读请求，开启对冲以削减长尾
+            HedgeOptions hedge;
+            hedge.enabled = true;
+            _service_manager->declare(_user_service_name, LoadBalancePolicy::LEAST_BUSY, hedge);
             _discovery = std::make_shared<Discovery>(_user_service_name, etcd_addr,
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->online(name, ip);
+                [this](const ServiceDiff& diff) {
+                    _service_manager->apply(diff.online, diff.offline);
                 },
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->offline(name, ip);
-                });
+                [this](const std::string& key, const std::string& load) {
+                    _service_manager->update_load(key, load);
+                },
+                Discovery::snapshot_file(snapshot_dir, _user_service_name));
             _reg = make_shared<Registry>(transmit_service_name, etcd_addr, etcd_timeout);
             _reg->registry(instance_name, service_ip + ":" + to_string(service_port));
             return true;
@@ -168,12 +233,42 @@ namespace blus {
             return true;
         }
 
+        // 设置会话成员缓存(可选)，订阅成员变更事件失效缓存，需在make_rabbitmq之后、make_rpc之前调用
+        bool make_member_cache(int ttl_sec, int max_sessions, const std::string& instance_name) {
+            if (!_rabbitmq) {
+                LOG_ERROR("rabbitmq服务未设置");
+                return false;
+            }
+            auto cache = std::make_shared<MembershipCache>(ttl_sec, max_sessions);
+            _member_events = std::make_shared<ChangeEvents>(_rabbitmq, kMemberChangeExchange);
+            _member_events->subscribe(instance_name, [cache](const std::string& session_id) {
+                cache->invalidate(session_id);
+                });
+            _member_cache = cache;
+            return true;
+        }
+
+        // 设置发送者资料缓存(可选)，订阅用户资料变更事件失效缓存，需在make_rabbitmq之后、make_rpc之前调用
+        bool make_profile_cache(int ttl_sec, int max_users, const std::string& instance_name) {
+            if (!_rabbitmq) {
+                LOG_ERROR("rabbitmq服务未设置");
+                return false;
+            }
+            auto cache = std::make_shared<ProfileCache>(ttl_sec, max_users, kProfileFreshSec);
+            _profile_events = std::make_shared<ChangeEvents>(_rabbitmq, kProfileChangeExchange);
+            _profile_events->subscribe(instance_name, [cache](const std::string& user_id) {
+                cache->invalidate(user_id);
+                });
+            _profile_cache = cache;
+            return true;
+        }
+
         // 设置rpc服务
         bool make_rpc(int32_t listen_port, uint8_t thread_num, int rpc_timeout) {
             _server = make_shared<brpc::Server>();
 
             auto service = new MsgTransmitServiceImpl(_mysql, _user_service_name, _service_manager, _discovery, _rabbitmq,
-                _exchange_name, _queue_name);
+                _exchange_name, _queue_name, _io, _member_cache, _profile_cache);
             int ret = _server->AddService(service, brpc::SERVER_OWNS_SERVICE);
             if (ret != 0) {
                 LOG_ERROR("TransmitServer添加服务失败");
@@ -214,7 +309,8 @@ namespace blus {
         }
     private:
         std::string _user_service_name;
-        std::shared_ptr<odb::database> _mysql;
+        ShardRouter::Ptr _mysql;
+        Discovery::Ptr _shard_dis;
         Discovery::Ptr _discovery;
         Registry::Ptr _reg;
         RabbitMQ::Ptr _rabbitmq;
@@ -222,5 +318,10 @@ namespace blus {
         std::string _queue_name;
         ServiceManager::Ptr _service_manager;
         std::shared_ptr<brpc::Server> _server;
+        IOExecutors _io;
+        MembershipCache::Ptr _member_cache;
+        ChangeEvents::Ptr _member_events;
+        std::shared_ptr<ProfileCache> _profile_cache;
+        ChangeEvents::Ptr _profile_events;
     };
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "membership_cache.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+
+static blus::MembershipCache::Loader loader(int& calls, std::vector<std::string> members, bool ok = true) {
+    return [&calls, members, ok](std::vector<std::string>& out) {
+        ++calls;
+        out = members;
+        return ok;
+    };
+}
+
+TEST(StringInterner, intern) {
+    blus::StringInterner interner;
+    auto a = interner.intern("user_a");
+    auto b = interner.intern("user_b");
+    EXPECT_NE(a, b);
+    EXPECT_EQ(interner.intern("user_a"), a);
+    EXPECT_EQ(interner.resolve(b), "user_b");
+    EXPECT_EQ(interner.size(), 2);
+}
+
+TEST(MembershipCache, hit_and_invalidate) {
+    blus::MembershipCache cache(60);
+    int calls = 0;
+    std::vector<std::string> members;
+    ASSERT_TRUE(cache.get("s1", members, loader(calls, { "u2", "u1", "u3" })));
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(members.size(), 3);
+
+    // 命中缓存，不再加载
+    members.clear();
+    ASSERT_TRUE(cache.get("s1", members, loader(calls, { "x" })));
+    EXPECT_EQ(calls, 1);
+    std::sort(members.begin(), members.end());
+    EXPECT_EQ(members, (std::vector<std::string>{ "u1", "u2", "u3" }));
+
+    // 失效后重新加载
+    cache.invalidate("s1");
+    members.clear();
+    ASSERT_TRUE(cache.get("s1", members, loader(calls, { "u1" })));
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(members, (std::vector<std::string>{ "u1" }));
+}
+
+TEST(MembershipCache, failure_and_empty_not_cached) {
+    blus::MembershipCache cache(60);
+    int calls = 0;
+    std::vector<std::string> members;
+    EXPECT_FALSE(cache.get("s1", members, loader(calls, {}, false)));
+    EXPECT_TRUE(cache.get("s1", members, loader(calls, {})));
+    EXPECT_TRUE(members.empty());
+    EXPECT_TRUE(cache.get("s1", members, loader(calls, { "u1" })));
+    EXPECT_EQ(calls, 3);
+    EXPECT_EQ(cache.size(), 1);
+}
+
+TEST(MembershipCache, ttl) {
+    blus::MembershipCache cache(1);
+    int calls = 0;
+    std::vector<std::string> members;
+    cache.get("s1", members, loader(calls, { "u1" }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    members.clear();
+    cache.get("s1", members, loader(calls, { "u1", "u2" }));
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(members.size(), 2);
+}
+
+TEST(MembershipCache, invalidate_during_load) {
+    // 加载期间发生失效时，加载结果可能已过时，不写入缓存
+    blus::MembershipCache cache(60);
+    int calls = 0;
+    std::vector<std::string> members;
+    cache.get("s1", members, [&](std::vector<std::string>& out) {
+        ++calls;
+        out = { "stale" };
+        cache.invalidate("s1");
+        return true;
+        });
+    EXPECT_EQ(members, (std::vector<std::string>{ "stale" }));
+    members.clear();
+    cache.get("s1", members, loader(calls, { "fresh" }));
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(members, (std::vector<std::string>{ "fresh" }));
+}
+
+TEST(MembershipCache, bounded) {
+    blus::MembershipCache cache(60, 16);
+    int calls = 0;
+    std::vector<std::string> members;
+    for (int i = 0; i < 1000; ++i) {
+        members.clear();
+        cache.get("s" + std::to_string(i), members, loader(calls, { "u1" }));
+    }
+    EXPECT_LE(cache.size(), 16);
+}
+
+TEST(TtlCache, put_get_invalidate) {
+    blus::TtlCache<std::string> cache(60, 1024);
+    std::string value;
+    EXPECT_FALSE(cache.get("u1", value));
+    cache.put("u1", "nick1", cache.token("u1"));
+    ASSERT_TRUE(cache.get("u1", value));
+    EXPECT_EQ(value, "nick1");
+    // 加载期间资料变更，旧值不写入
+    auto token = cache.token("u1");
+    cache.invalidate("u1");
+    cache.put("u1", "stale", token);
+    EXPECT_FALSE(cache.get("u1", value));
+    cache.put("u1", "nick2", cache.token("u1"));
+    ASSERT_TRUE(cache.get("u1", value));
+    EXPECT_EQ(value, "nick2");
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(TtlCache, fresh_after_invalidate) {
+    // 失效后的窗口内加载应读取最新数据，窗口过后恢复读副本
+    blus::TtlCache<std::string> cache(60, 1024, 1);
+    EXPECT_FALSE(cache.fresh_required("u1"));
+    cache.invalidate("u1");
+    EXPECT_TRUE(cache.fresh_required("u1"));
+    EXPECT_FALSE(cache.fresh_required("u2"));
+    cache.put("u1", "nick1", cache.token("u1"));
+    EXPECT_TRUE(cache.fresh_required("u1"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    EXPECT_FALSE(cache.fresh_required("u1"));
+    cache.clear();
+    EXPECT_TRUE(cache.fresh_required("u2"));
+    // 未设置窗口时不记录
+    blus::TtlCache<std::string> plain(60, 1024);
+    plain.invalidate("u1");
+    EXPECT_FALSE(plain.fresh_required("u1"));
+}
+
+TEST(TtlCache, fresh_window_bounded) {
+    // 记录数超过分片上限时整个分片按失效处理，不会漏掉需要读最新数据的key
+    blus::TtlCache<std::string> cache(60, 16, 60);
+    for (int i = 0; i < 100; ++i) {
+        cache.invalidate("u" + std::to_string(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(cache.fresh_required("u" + std::to_string(i)));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -50,6 +50,26 @@ TEST(odb, remove) {
     EXPECT_TRUE(g_csm_table->remove("test_session2"));
 }
 
+TEST(odb, on_change) {
+    std::vector<std::string> changed;
+    g_csm_table->on_change([&changed](const std::string& session_id) {
+        changed.push_back(session_id);
+        });
+    blus::ChatSessionMember csm1, csm2;
+    csm1.session_id("test_session4");
+    csm1.user_id("test_user1");
+    csm2.session_id("test_session5");
+    csm2.user_id("test_user2");
+    EXPECT_TRUE(g_csm_table->append(csm1));
+    EXPECT_TRUE(g_csm_table->append(std::vector<blus::ChatSessionMember>{ csm1, csm2 }));
+    EXPECT_TRUE(g_csm_table->remove("test_session4"));
+    EXPECT_TRUE(g_csm_table->remove("test_session5"));
+    g_csm_table->on_change(nullptr);
+    // 单条新增1次 + 批量新增涉及2个会话 + 删除2次
+    EXPECT_EQ(changed.size(), 5);
+    EXPECT_EQ(std::count(changed.begin(), changed.end(), "test_session4"), 3);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -14,6 +14,7 @@ DEFINE_string(mysql_host, "localhost", "mysql服务器地址");
 DEFINE_int32(mysql_port, 3306, "mysql服务器端口");
 DEFINE_int32(mysql_conn_pool_count, 10, "mysql连接池大小");
 DEFINE_string(mysql_socket, "", "mysql socket路径");
+DEFINE_string(mysql_replicas, "", "mysql只读从库地址, 逗号分隔的host:port, 为空时读写都走主库");
 
 DEFINE_int32(redis_db, 0, "Redis数据库号");
 DEFINE_string(redis_host, "localhost", "Redis主机名");
@@ -26,6 +27,10 @@ DEFINE_string(email_username, "", "登录用户名");
 DEFINE_string(email_password, "", "登录授权码");
 DEFINE_string(email_content_type, "html", "邮件内容类型");
 
+DEFINE_string(rabbitmq_host, "127.0.0.1:5672", "RabbitMQ 服务器地址, 带端口, 用于发布用户资料变更事件, 为空时不发布(转发服务的资料缓存需同时关闭)");
+DEFINE_string(rabbitmq_user, "root", "RabbitMQ 用户名");
+DEFINE_string(rabbitmq_password, "", "RabbitMQ 密码");
+
 DEFINE_string(etcd_address, "", "etcd注册中心地址");
 DEFINE_string(file_service_name, "", "文件管理服务名称");
 DEFINE_string(user_service_name, "", "用户服务名称");
@@ -33,10 +38,17 @@ DEFINE_string(instance_name, "", "实例名称");
 DEFINE_string(service_ip, "", "实例供外部访问的ip");
 DEFINE_int32(service_port, 0, "服务端口");
 DEFINE_int32(etcd_timeout, 3, "ttl");
+DEFINE_string(discovery_snapshot_dir, "", "服务发现快照目录, 启动时先按快照提供服务再与etcd核对, 为空时不使用");
 
 DEFINE_int32(listen_port, 7070, "Rpc监听端口");
 DEFINE_int32(rpc_timeout, -1, "Rpc超时时间");
 DEFINE_int32(rpc_threads, 1, "Rpc线程数");
+DEFINE_int32(io_mysql_threads, 8, "执行mysql阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_es_threads, 4, "执行es阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_redis_threads, 4, "执行redis阻塞调用的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_classifier_threads, 4, "执行llm文本分类请求的线程数, 0表示在rpc线程直接执行");
+DEFINE_int32(io_queue_size, 256, "每个后端阻塞调用的最大排队数, 超出时直接返回服务繁忙");
+DEFINE_int32(capacity_weight, 100, "实例容量权重, 按机器配置设置, 调用方据此按比例分配流量");
 
 DEFINE_string(llm_ip, "", "llm服务ip");
 DEFINE_int32(llm_port, 0, "llm服务端口");
@@ -49,11 +61,16 @@ int main(int argc, char* argv[]) {
     blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
 
     blus::UserServerBuilder builder{ FLAGS_file_service_name };
+    builder.make_load(FLAGS_capacity_weight, FLAGS_rpc_threads);
     builder.make_es({ FLAGS_es_url });
-    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8");
+    builder.make_io(FLAGS_io_mysql_threads, FLAGS_io_es_threads, FLAGS_io_redis_threads, FLAGS_io_classifier_threads, FLAGS_io_queue_size);
+    builder.make_mysql(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, FLAGS_mysql_conn_pool_count, FLAGS_mysql_port, "utf8", FLAGS_mysql_replicas);
     builder.make_redis(FLAGS_redis_db, FLAGS_redis_host, FLAGS_redis_port, FLAGS_redis_keep_alive);
+    if (!FLAGS_rabbitmq_host.empty()) {
+        builder.make_rabbitmq(FLAGS_rabbitmq_user, FLAGS_rabbitmq_password, FLAGS_rabbitmq_host);
+    }
     builder.make_email(FLAGS_email_from, FLAGS_email_smtp, FLAGS_email_username, FLAGS_email_password, FLAGS_email_content_type);
-    builder.make_etcd(FLAGS_etcd_address, FLAGS_user_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout);
+    builder.make_etcd(FLAGS_etcd_address, FLAGS_user_service_name, FLAGS_instance_name, FLAGS_service_ip, FLAGS_service_port, FLAGS_etcd_timeout, FLAGS_discovery_snapshot_dir);
     builder.make_rpc(FLAGS_listen_port, FLAGS_rpc_threads, FLAGS_rpc_timeout, FLAGS_llm_ip, FLAGS_llm_port, FLAGS_classifier_service_name);
     auto server = builder.build();
     if (server) {
@@ -16,19 +16,25 @@
 #include "data_redis.hpp"
 #include "email.hpp"
 #include "channel.hpp"
+#include "deadline.hpp"
 #include "llm.hpp"
+#include "io_executor.hpp"
+#include "change_events.hpp"
 
 namespace blus {
     class UserServiceImpl : public UserService {
     public:
         UserServiceImpl(const std::shared_ptr<elasticlient::Client>& es,
-            const std::shared_ptr<odb::database>& mysql,
+            const DBRouter::Ptr& mysql,
             const std::shared_ptr<sw::redis::Redis>& redis,
             const EmailSender::Ptr& email,
             const std::string& file_service_name,
             const ServiceManager::Ptr& sm,
             const Discovery::Ptr& discovery,
-            const TextClassifier::Ptr& text_classifier)
+            const TextClassifier::Ptr& text_classifier,
+            const LoadSampler::Ptr& sampler = nullptr,
+            const IOExecutors& io = {},
+            const ChangeEvents::Ptr& profile_events = nullptr)
             : _es(es), _mysql(mysql), _redis(redis)
             , _es_user(std::make_shared<ESUser>(_es))
             , _user_table(std::make_shared<UserTable>(_mysql))
@@ -39,7 +45,10 @@ namespace blus {
             , _file_service_name(file_service_name)
             , _service_manager(sm)
             , _discovery(discovery)
-            , _text_classifier(text_classifier) {
+            , _text_classifier(text_classifier)
+            , _sampler(sampler)
+            , _io(io)
+            , _profile_events(profile_events) {
             if (!_es_user->createIndex()) {
                 LOG_ERROR("创建es索引失败");
                 exit(EXIT_FAILURE);
@@ -52,6 +61,7 @@ namespace blus {
             NICKNAME_EXIST,
             NICKNAME_STYLE_ERROR, // 昵称不符合格式要求
             NICKNAME_INVALID, // 昵称敏感（模型检测不通过）
+            NICKNAME_BUSY, // 分类或查询执行器繁忙，未能检测
         };
 
         nickname_status check_nickname(const std::string& nickname) {
@@ -59,18 +69,29 @@ namespace blus {
                 return nickname_status::NICKNAME_STYLE_ERROR;
             }
             std::string result;
-            try {
-                result = _text_classifier->classify(nickname);
+            bool failed = false;
+            if (!offload(_io.classifier, [&] {
+                try {
+                    result = _text_classifier->classify(nickname);
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("模型请求失败: {}", e.what());
+                    failed = true;
+                }
+                })) {
+                return nickname_status::NICKNAME_BUSY;
             }
-            catch (const std::exception& e) {
-                LOG_ERROR("模型请求失败: {}", e.what());
+            if (failed) {
                 return nickname_status::NICKNAME_INVALID;
             }
             if (result == "不合规") {
                 return nickname_status::NICKNAME_INVALID;
             }
             // 检测昵称对应用户是否存在
-            auto user = _user_table->select_by_nickname(nickname);
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, [&] { user = _user_table->select_by_nickname(nickname); })) {
+                return nickname_status::NICKNAME_BUSY;
+            }
             if (user) {
                 return nickname_status::NICKNAME_EXIST;
             }
@@ -113,6 +134,7 @@ namespace blus {
             UserRegisterRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& nickname = request->nickname();
             switch (check_nickname(nickname)) {
@@ -131,6 +153,10 @@ namespace blus {
                 response->set_errmsg("昵称敏感");
                 response->set_success(false);
                 return;
+            case nickname_status::NICKNAME_BUSY:
+                response->set_errmsg("服务繁忙");
+                response->set_success(false);
+                return;
             default:
                 LOG_CRITICAL("未知昵称状态");
                 exit(EXIT_FAILURE);
@@ -160,18 +186,25 @@ namespace blus {
             }
             std::string uid = uuid();
             User user{ uid, nickname, sha256_password };
-            if (!_user_table->insert(user)) {
+            bool inserted = false;
+            if (!offload(_io.mysql, response, [&] { inserted = _user_table->insert(user); })) {
+                return;
+            }
+            if (!inserted) {
                 LOG_ERROR("{} - mysql数据库插入失败", request->request_id());
                 response->set_errmsg("注册失败");
                 response->set_success(false);
                 return;
             }
-            if (!_es_user->append(uid, "", nickname, "", "")) {
+            bool indexed = false;
+            if (offload(_io.es, response, [&] { indexed = _es_user->append(uid, "", nickname, "", ""); }) && !indexed) {
                 LOG_ERROR("{} - es数据库插入失败", request->request_id());
                 response->set_errmsg("注册失败");
                 response->set_success(false);
+            }
+            if (!indexed) {
                 // mysql插入成功，es插入失败，删除mysql数据
-                _user_table->remove(uid);
+                compensate(_io.mysql, [&] { return _user_table->remove(uid); });
                 return;
             }
             response->set_success(true);
@@ -182,11 +215,15 @@ namespace blus {
             UserLoginRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& nickname = request->nickname();
             const std::string& password = request->password();
             const std::string& sha256_password = hashPassword(password);
-            auto user = _user_table->select_by_nickname(nickname);
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_nickname(nickname); })) {
+                return;
+            }
             if (!user) {
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
@@ -197,16 +234,9 @@ namespace blus {
                 response->set_success(false);
                 return;
             }
-            if (_status->exists(user->user_id())) {
-                response->set_errmsg("用户已在其它地方登录");
-                response->set_success(false);
+            if (!login(user->user_id(), response)) {
                 return;
             }
-            // 生成登录会话ID, 保存ID 维持登陆状态
-            std::string ssid = uuid();
-            _session->append(ssid, user->user_id());
-            _status->append(user->user_id());
-            response->set_login_session_id(ssid);
             response->set_success(true);
         }
 
@@ -215,6 +245,7 @@ namespace blus {
             EmailVerifyCodeRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& email = request->email();
             if (!check_email(email)) {
@@ -235,7 +266,11 @@ namespace blus {
             }
             std::string cid = uuid();
             // 10分钟内有效
-            if (!_verify_code->append(cid, oss.str(), 600)) {
+            bool stored = false;
+            if (!offload(_io.redis, response, [&] { stored = _verify_code->append(cid, oss.str(), 600); })) {
+                return;
+            }
+            if (!stored) {
                 LOG_ERROR("{} - redis数据库插入失败", request->request_id());
                 response->set_errmsg("验证码存储失败");
                 response->set_success(false);
@@ -250,6 +285,7 @@ namespace blus {
             EmailRegisterRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& email = request->email();
             const std::string& verify_code_id = request->verify_code_id();
@@ -261,14 +297,21 @@ namespace blus {
                 return;
             }
             // 检测验证码是否正确
-            std::string redis_code = _verify_code->code(verify_code_id).value();
-            if (redis_code != verify_code) {
+            bool code_ok = false;
+            if (!offload(_io.redis, response, [&] { code_ok = _verify_code->code(verify_code_id) == verify_code; })) {
+                return;
+            }
+            if (!code_ok) {
                 response->set_errmsg("验证码错误");
                 response->set_success(false);
                 return;
             }
             // 判断邮箱是否已被注册过
-            if (_user_table->select_by_email(email)) {
+            std::shared_ptr<User> exist;
+            if (!offload(_io.mysql, response, [&] { exist = _user_table->select_by_email(email); })) {
+                return;
+            }
+            if (exist) {
                 response->set_errmsg("邮箱已被注册");
                 response->set_success(false);
                 return;
@@ -276,24 +319,31 @@ namespace blus {
             // mysql插入用户
             std::string uid = uuid();
             User user{ uid, email };
-            if (!_user_table->insert(user)) {
+            bool inserted = false;
+            if (!offload(_io.mysql, response, [&] { inserted = _user_table->insert(user); })) {
+                return;
+            }
+            if (!inserted) {
                 LOG_ERROR("{} - mysql数据库插入失败", request->request_id());
                 response->set_errmsg("注册失败");
                 response->set_success(false);
                 return;
             }
             // es插入用户
-            if (!_es_user->append(uid, email, user.nickname(), "", "")) {
+            bool indexed = false;
+            if (offload(_io.es, response, [&] { indexed = _es_user->append(uid, email, user.nickname(), "", ""); }) && !indexed) {
                 LOG_ERROR("{} - es数据库插入失败", request->request_id());
                 response->set_errmsg("注册失败");
                 response->set_success(false);
+            }
+            if (!indexed) {
                 // mysql插入成功，es插入失败，删除mysql数据
-                _user_table->remove(uid);
+                compensate(_io.mysql, [&] { return _user_table->remove(uid); });
                 return;
             }
             response->set_success(true);
-            // 删除验证码
-            _verify_code->remove(verify_code_id);
+            // 删除验证码，执行器繁忙时交给过期时间清理
+            offload(_io.redis, [&] { _verify_code->remove(verify_code_id); });
         }
 
         void EmailLogin(google::protobuf::RpcController* controller,
@@ -301,6 +351,7 @@ namespace blus {
             EmailLoginRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& email = request->email();
             const std::string& verify_code_id = request->verify_code_id();
@@ -310,32 +361,34 @@ namespace blus {
                 response->set_success(false);
                 return;
             }
-            auto user = _user_table->select_by_email(email);
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_email(email); })) {
+                return;
+            }
             if (!user) {
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
             // 检测验证码是否正确
-            auto redis_code = _verify_code->code(verify_code_id);
-            if (redis_code != verify_code) {
+            bool code_ok = false;
+            if (!offload(_io.redis, response, [&] {
+                code_ok = _verify_code->code(verify_code_id) == verify_code;
+                if (code_ok) {
+                    // 删除验证码
+                    _verify_code->remove(verify_code_id);
+                }
+                })) {
+                return;
+            }
+            if (!code_ok) {
                 response->set_errmsg("验证码错误");
                 response->set_success(false);
                 return;
             }
-            // 删除验证码
-            _verify_code->remove(verify_code_id);
-            // 检测用户是否登录
-            if (_status->exists(user->user_id())) {
-                response->set_errmsg("用户已在其它地方登录");
-                response->set_success(false);
+            if (!login(user->user_id(), response)) {
                 return;
             }
-            // 生成登录会话ID, 保存ID 维持登陆状态
-            std::string ssid = uuid();
-            _session->append(ssid, user->user_id());
-            _status->append(user->user_id());
-            response->set_login_session_id(ssid);
             response->set_success(true);
         }
 
@@ -345,16 +398,28 @@ namespace blus {
             GetUserInfoRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& uid = request->user_id();
-            auto user = _user_table->select_by_uid(uid);
+            auto deadline = Deadline::from(*request);
+            if (deadline.expired()) {
+                LOG_WARN("{}-{} 请求已超时，放弃处理", request->request_id(), uid);
+                response->set_errmsg("请求已超时");
+                response->set_success(false);
+                return;
+            }
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] {
+                user = request->fresh() ? _user_table->select_by_uid_primary(uid) : _user_table->select_by_uid(uid);
+                })) {
+                return;
+            }
             if (!user) {
                 LOG_ERROR("{}-{} mysql数据库查询失败: 未找到用户信息", request->request_id(), uid);
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
-            // 调用file服务获取头像
             UserInfo* user_info = response->mutable_user_info();
             user_info->set_user_id(user->user_id());
             user_info->set_nickname(user->nickname());
@@ -362,20 +427,32 @@ namespace blus {
             user_info->set_email(user->email());
             const auto& avatar_id = user->avatar_id();
             if (!avatar_id.empty()) {
-                auto channel = _service_manager->get(_file_service_name);
-                if (!channel) {
+                user_info->set_avatar_id(avatar_id);
+                user_info->set_avatar_hash(user->avatar_hash());
+            }
+            // 调用file服务获取头像, LITE模式不获取
+            if (!avatar_id.empty() && request->view() == USER_INFO_FULL) {
+                auto lease = _service_manager->lease(_file_service_name);
+                if (!lease) {
                     LOG_ERROR("{}-{} 获取file服务失败", request->request_id(), uid);
                     response->set_errmsg("获取file服务失败");
                     response->set_success(false);
                     return;
                 }
-                FileService_Stub stub(channel.get());
+                FileService_Stub stub(lease.channel());
                 GetSingleFileReq file_request;
                 file_request.set_request_id(request->request_id());
                 file_request.set_file_id(avatar_id);
                 GetSingleFileRsp file_response;
                 brpc::Controller cntl;
+                if (!deadline.propagate(&cntl, &file_request)) {
+                    LOG_WARN("{}-{} 请求已超时，放弃获取头像", request->request_id(), uid);
+                    response->set_errmsg("请求已超时");
+                    response->set_success(false);
+                    return;
+                }
                 stub.GetSingleFile(&cntl, &file_request, &file_response, nullptr);
+                lease.release(cntl.Failed());
                 if (cntl.Failed() || !file_response.success()) {
                     LOG_ERROR("{}-{} file服务查询失败: {}", request->request_id(), uid, cntl.ErrorText());
                     response->set_errmsg("获取头像失败");
@@ -392,35 +469,37 @@ namespace blus {
             GetMultiUserInfoRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
-            // 获取请求中的用户ID（可能包含重复项）
+            auto deadline = Deadline::from(*request);
+            if (deadline.expired()) {
+                LOG_WARN("{} - 请求已超时，放弃处理", request->request_id());
+                response->set_errmsg("请求已超时");
+                response->set_success(false);
+                return;
+            }
+            // 获取请求中的用户ID（可能包含重复项），由批量查询去重
             const auto& user_id_list = request->users_id();
-            std::vector<std::string> original_ids;
-            original_ids.reserve(user_id_list.size());
-            for (int i = 0; i < user_id_list.size(); ++i) {
-                original_ids.push_back(user_id_list.Get(i));
-            }
-            // 去重
-            std::vector<std::string> dedup_ids;
-            std::unordered_set<std::string> seen;
-            for (const auto& id : original_ids) {
-                if (seen.insert(id).second) {
-                    dedup_ids.push_back(id);
-                }
+            std::vector<std::string> ids(user_id_list.begin(), user_id_list.end());
+            std::unordered_map<std::string, std::shared_ptr<User>> user_map;
+            bool found = false;
+            if (!offload(_io.mysql, response, [&] { found = _user_table->select_users(ids, user_map); })) {
+                return;
             }
-            // 查询去重后的用户信息
-            auto users = _user_table->select_multi_users(dedup_ids);
-            if (users.size() != dedup_ids.size()) {
-                LOG_ERROR("{} - mysql数据库查询失败: 批量查找结果与要求不一致, 请求去重数量{}, 结果数量{}",
-                    request->request_id(), dedup_ids.size(), users.size());
-                response->set_errmsg("用户不存在");
+            if (!found) {
+                LOG_ERROR("{} - mysql数据库批量查询用户失败", request->request_id());
+                response->set_errmsg("查询用户信息失败");
                 response->set_success(false);
                 return;
             }
-            // 构造用户映射
-            std::unordered_map<std::string, std::shared_ptr<User>> user_map;
-            for (const auto& user : users) {
-                user_map[user->user_id()] = user;
+            for (const auto& id : ids) {
+                if (!user_map.count(id)) {
+                    LOG_ERROR("{} - mysql数据库查询失败: 用户{}不存在, 请求数量{}, 结果数量{}",
+                        request->request_id(), id, ids.size(), user_map.size());
+                    response->set_errmsg("用户不存在");
+                    response->set_success(false);
+                    return;
+                }
             }
             auto* out_map = response->mutable_users_info();
             for (const auto& [k, v] : user_map) {
@@ -429,24 +508,20 @@ namespace blus {
                 info.set_nickname(v->nickname());
                 info.set_description(v->description());
                 info.set_email(v->email());
+                if (!v->avatar_id().empty()) {
+                    info.set_avatar_id(v->avatar_id());
+                    info.set_avatar_hash(v->avatar_hash());
+                }
                 (*out_map)[k] = info;
             }
-            // 收集所有需要查询头像的 avatar_id（去重）
+            // 收集所有需要查询头像的 avatar_id（去重）, LITE模式不获取
             std::unordered_set<std::string> avatar_set;
             for (const auto& [_, v] : user_map) {
-                if (!v->avatar_id().empty()) {
+                if (!v->avatar_id().empty() && request->view() == USER_INFO_FULL) {
                     avatar_set.insert(v->avatar_id());
                 }
             }
             if (!avatar_set.empty()) {
-                auto channel = _service_manager->get(_file_service_name);
-                if (!channel) {
-                    LOG_ERROR("{} - 获取file服务失败", request->request_id());
-                    response->set_errmsg("获取file服务失败");
-                    response->set_success(false);
-                    return;
-                }
-                FileService_Stub stub(channel.get());
                 GetMultiFileReq file_request;
                 file_request.set_request_id(request->request_id());
                 for (const auto& aid : avatar_set) {
@@ -454,7 +529,13 @@ namespace blus {
                 }
                 GetMultiFileRsp file_response;
                 brpc::Controller cntl;
-                stub.GetMultiFile(&cntl, &file_request, &file_response, nullptr);
+                if (!deadline.propagate(&cntl, &file_request)) {
+                    LOG_WARN("{} - 请求已超时，放弃获取头像", request->request_id());
+                    response->set_errmsg("请求已超时");
+                    response->set_success(false);
+                    return;
+                }
+                _service_manager->call(_file_service_name, &FileService_Stub::GetMultiFile, &cntl, &file_request, &file_response);
                 if (cntl.Failed() || !file_response.success()) {
                     LOG_ERROR("{} - file服务查询失败: {}", request->request_id(), cntl.ErrorText());
                     response->set_errmsg("获取头像失败");
@@ -478,26 +559,31 @@ namespace blus {
             SetUserAvatarRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& uid = request->user_id();
             const std::string& avatar = request->avatar();
-            auto user = _user_table->select_by_uid(uid);
-            auto old_avatar_id = user->avatar_id();
+            auto deadline = Deadline::from(*request);
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_uid_primary(uid); })) {
+                return;
+            }
             if (!user) {
                 LOG_ERROR("{}-{} mysql数据库查询失败: 未找到用户信息", request->request_id(), uid);
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
+            auto old_avatar_id = user->avatar_id();
             // 调用file服务上传头像
-            auto channel = _service_manager->get(_file_service_name);
-            if (!channel) {
+            auto lease = _service_manager->lease(_file_service_name);
+            if (!lease) {
                 LOG_ERROR("{} - 获取file服务失败", request->request_id());
                 response->set_errmsg("获取file服务失败");
                 response->set_success(false);
                 return;
             }
-            FileService_Stub stub(channel.get());
+            FileService_Stub stub(lease.channel());
             PutSingleFileReq file_request;
             file_request.set_request_id(request->request_id());
             file_request.mutable_file_data()->set_file_content(avatar);
@@ -505,7 +591,14 @@ namespace blus {
             file_request.mutable_file_data()->set_file_size(avatar.size());
             blus::PutSingleFileRsp file_response;
             brpc::Controller cntl;
+            if (!deadline.propagate(&cntl, &file_request)) {
+                LOG_WARN("{}-{} 请求已超时，放弃上传头像", request->request_id(), uid);
+                response->set_errmsg("请求已超时");
+                response->set_success(false);
+                return;
+            }
             stub.PutSingleFile(&cntl, &file_request, &file_response, nullptr);
+            lease.release(cntl.Failed());
             if (cntl.Failed() || !file_response.success()) {
                 LOG_ERROR("{}-{} file服务上传失败: {}", request->request_id(), uid, cntl.ErrorText());
                 response->set_errmsg("头像上传失败");
@@ -514,7 +607,11 @@ namespace blus {
             }
             const auto& avatar_id = file_response.file_info().file_id();
             // 更新es用户头像
-            if (!_es_user->append(user->user_id(), user->email(), user->nickname(), user->description(), avatar_id)) {
+            bool indexed = false;
+            if (!offload(_io.es, response, [&] { indexed = _es_user->append(user->user_id(), user->email(), user->nickname(), user->description(), avatar_id); })) {
+                return;
+            }
+            if (!indexed) {
                 LOG_ERROR("{}-{} es数据库更新失败: 更新用户头像失败", request->request_id(), uid);
                 response->set_errmsg("头像更新失败");
                 response->set_success(false);
@@ -522,16 +619,21 @@ namespace blus {
             }
             // 更新mysql用户头像
             user->avatar_id(avatar_id);
-            if (!_user_table->update(user)) {
+            user->avatar_hash(sha256(avatar));
+            bool updated = false;
+            if (offload(_io.mysql, response, [&] { updated = _user_table->update(user); }) && !updated) {
                 LOG_ERROR("{}-{} mysql数据库更新失败: 更新用户头像失败", request->request_id(), uid);
                 response->set_errmsg("头像更新失败");
                 response->set_success(false);
+            }
+            if (!updated) {
                 // es更新成功，mysql更新失败，还原es数据
-                if (!_es_user->append(user->user_id(), user->email(), user->nickname(), user->description(), old_avatar_id)) {
+                if (!compensate(_io.es, [&] { return _es_user->append(user->user_id(), user->email(), user->nickname(), user->description(), old_avatar_id); })) {
                     LOG_CRITICAL("{}-{} es数据库恢复头像失败", request->request_id(), uid);
                 }
                 return;
             }
+            profile_changed(uid);
             response->set_success(true);
         }
 
@@ -540,6 +642,7 @@ namespace blus {
             SetUserNicknameRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& uid = request->user_id();
             const std::string& nickname = request->nickname();
@@ -559,20 +662,31 @@ namespace blus {
                 response->set_errmsg("昵称敏感");
                 response->set_success(false);
                 return;
+            case nickname_status::NICKNAME_BUSY:
+                response->set_errmsg("服务繁忙");
+                response->set_success(false);
+                return;
             default:
                 LOG_CRITICAL("未知昵称状态");
                 exit(EXIT_FAILURE);
             }
-            auto user = _user_table->select_by_uid(uid);
-            auto old_nickname = user->nickname();
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_uid_primary(uid); })) {
+                return;
+            }
             if (!user) {
                 LOG_ERROR("{}-{} mysql数据库查询失败: 未找到用户信息", request->request_id(), uid);
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
+            auto old_nickname = user->nickname();
             // 更新es用户昵称
-            if (!_es_user->append(user->user_id(), user->email(), nickname, user->description(), user->avatar_id())) {
+            bool indexed = false;
+            if (!offload(_io.es, response, [&] { indexed = _es_user->append(user->user_id(), user->email(), nickname, user->description(), user->avatar_id()); })) {
+                return;
+            }
+            if (!indexed) {
                 LOG_ERROR("{}-{} es数据库更新失败: 更新用户昵称失败", request->request_id(), uid);
                 response->set_errmsg("昵称更新失败");
                 response->set_success(false);
@@ -580,16 +694,20 @@ namespace blus {
             }
             // 更新mysql用户昵称
             user->nickname(nickname);
-            if (!_user_table->update(user)) {
+            bool updated = false;
+            if (offload(_io.mysql, response, [&] { updated = _user_table->update(user); }) && !updated) {
                 LOG_ERROR("{}-{} mysql数据库更新失败: 更新用户昵称失败", request->request_id(), uid);
                 response->set_errmsg("昵称更新失败");
                 response->set_success(false);
+            }
+            if (!updated) {
                 // es更新成功，mysql更新失败，恢复es数据
-                if (!_es_user->append(user->user_id(), user->email(), old_nickname, user->description(), user->avatar_id())) {
+                if (!compensate(_io.es, [&] { return _es_user->append(user->user_id(), user->email(), old_nickname, user->description(), user->avatar_id()); })) {
                     LOG_CRITICAL("{}-{} es数据库恢复昵称失败", request->request_id(), uid);
                 }
                 return;
             }
+            profile_changed(uid);
             response->set_success(true);
         }
 
@@ -598,6 +716,7 @@ namespace blus {
             SetUserDescriptionRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& uid = request->user_id();
             const std::string& description = request->description();
@@ -608,31 +727,41 @@ namespace blus {
             }
             // 检测签名是否敏感
             std::string result;
-            try {
-                result = _text_classifier->classify(description);
-            }
-            catch (const std::exception& e) {
-                LOG_ERROR("模型请求失败: {}", e.what());
-                response->set_errmsg("签名敏感");
-                response->set_success(false);
+            bool failed = false;
+            if (!offload(_io.classifier, response, [&] {
+                try {
+                    result = _text_classifier->classify(description);
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("模型请求失败: {}", e.what());
+                    failed = true;
+                }
+                })) {
                 return;
             }
-            if (result == "不合规") {
+            if (failed || result == "不合规") {
                 response->set_errmsg("签名敏感");
                 response->set_success(false);
                 return;
             }
             // 检测用户是否存在
-            auto user = _user_table->select_by_uid(uid);
-            auto old_description = user->description();
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_uid_primary(uid); })) {
+                return;
+            }
             if (!user) {
                 LOG_ERROR("{}-{} mysql数据库查询失败: 未找到用户信息", request->request_id(), uid);
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
+            auto old_description = user->description();
             // 更新es用户签名
-            if (!_es_user->append(user->user_id(), user->email(), user->nickname(), description, user->avatar_id())) {
+            bool indexed = false;
+            if (!offload(_io.es, response, [&] { indexed = _es_user->append(user->user_id(), user->email(), user->nickname(), description, user->avatar_id()); })) {
+                return;
+            }
+            if (!indexed) {
                 LOG_ERROR("{}-{} es数据库更新失败: 更新用户签名失败", request->request_id(), uid);
                 response->set_errmsg("签名更新失败");
                 response->set_success(false);
@@ -640,16 +769,20 @@ namespace blus {
             }
             // 更新mysql用户签名
             user->description(description);
-            if (!_user_table->update(user)) {
+            bool updated = false;
+            if (offload(_io.mysql, response, [&] { updated = _user_table->update(user); }) && !updated) {
                 LOG_ERROR("{}-{} mysql数据库更新失败: 更新用户签名失败", request->request_id(), uid);
                 response->set_errmsg("签名更新失败");
                 response->set_success(false);
+            }
+            if (!updated) {
                 // es更新成功，mysql更新失败，恢复es数据
-                if (!_es_user->append(user->user_id(), user->email(), user->nickname(), old_description, user->avatar_id())) {
+                if (!compensate(_io.es, [&] { return _es_user->append(user->user_id(), user->email(), user->nickname(), old_description, user->avatar_id()); })) {
                     LOG_CRITICAL("{}-{} es数据库恢复签名失败", request->request_id(), uid);
                 }
                 return;
             }
+            profile_changed(uid);
             response->set_success(true);
         }
 
@@ -658,6 +791,7 @@ namespace blus {
             SetUserEmailRsp* response,
             google::protobuf::Closure* done) override {
             brpc::ClosureGuard rpc_guard(done);
+            LoadSampler::InflightGuard inflight(_sampler);
             response->set_request_id(request->request_id());
             const std::string& uid = request->user_id();
             const std::string& email = request->email();
@@ -670,24 +804,38 @@ namespace blus {
             const std::string& verify_code_id = request->email_verify_code_id();
             const std::string& verify_code = request->email_verify_code();
             // 检测验证码是否正确
-            auto redis_code = _verify_code->code(verify_code_id);
-            if (redis_code != verify_code) {
+            bool code_ok = false;
+            if (!offload(_io.redis, response, [&] {
+                code_ok = _verify_code->code(verify_code_id) == verify_code;
+                if (code_ok) {
+                    // 删除验证码
+                    _verify_code->remove(verify_code_id);
+                }
+                })) {
+                return;
+            }
+            if (!code_ok) {
                 response->set_errmsg("验证码错误");
                 response->set_success(false);
                 return;
             }
-            // 删除验证码
-            _verify_code->remove(verify_code_id);
-            auto user = _user_table->select_by_uid(uid);
-            auto old_email = user->email();
+            std::shared_ptr<User> user;
+            if (!offload(_io.mysql, response, [&] { user = _user_table->select_by_uid_primary(uid); })) {
+                return;
+            }
             if (!user) {
                 LOG_ERROR("{}-{} mysql数据库查询失败: 未找到用户信息", request->request_id(), uid);
                 response->set_errmsg("用户不存在");
                 response->set_success(false);
                 return;
             }
+            auto old_email = user->email();
             // 更新es用户邮箱
-            if (!_es_user->append(user->user_id(), email, user->nickname(), user->description(), user->avatar_id())) {
+            bool indexed = false;
+            if (!offload(_io.es, response, [&] { indexed = _es_user->append(user->user_id(), email, user->nickname(), user->description(), user->avatar_id()); })) {
+                return;
+            }
+            if (!indexed) {
                 LOG_ERROR("{}-{} es数据库更新失败: 更新用户邮箱失败", request->request_id(), uid);
                 response->set_errmsg("邮箱更新失败");
                 response->set_success(false);
@@ -695,21 +843,70 @@ namespace blus {
             }
             // 更新mysql用户邮箱
             user->email(email);
-            if (!_user_table->update(user)) {
+            bool updated = false;
+            if (offload(_io.mysql, response, [&] { updated = _user_table->update(user); }) && !updated) {
                 LOG_ERROR("{}-{} mysql数据库更新失败: 更新用户邮箱失败", request->request_id(), uid);
                 response->set_errmsg("邮箱更新失败");
                 response->set_success(false);
+            }
+            if (!updated) {
                 // es更新成功，mysql更新失败，恢复es数据
-                if (!_es_user->append(user->user_id(), old_email, user->nickname(), user->description(), user->avatar_id())) {
+                if (!compensate(_io.es, [&] { return _es_user->append(user->user_id(), old_email, user->nickname(), user->description(), user->avatar_id()); })) {
                     LOG_CRITICAL("{}-{} es数据库恢复邮箱失败", request->request_id(), uid);
                 }
                 return;
             }
+            profile_changed(uid);
             response->set_success(true);
         }
     private:
+        // 回滚已生效的写入，执行器繁忙时在当前线程执行，不能因排队被拒绝而丢弃
+        bool compensate(const IOExecutor::Ptr& io, const std::function<bool()>& task) {
+            bool ok = false;
+            if (offload(io, [&] { ok = task(); })) {
+                return ok;
+            }
+            try {
+                return task();
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("回滚操作异常: {}", e.what());
+                return false;
+            }
+        }
+
+        // 通知其他服务失效该用户的资料缓存
+        void profile_changed(const std::string& uid) {
+            if (_profile_events) {
+                _profile_events->publish(uid);
+            }
+        }
+
+        // 检测用户未在其它地方登录后生成登录会话ID, 保存ID 维持登陆状态；失败时已设置应答
+        template <typename Response>
+        bool login(const std::string& uid, Response* response) {
+            bool online = false;
+            std::string ssid = uuid();
+            if (!offload(_io.redis, response, [&] {
+                online = _status->exists(uid);
+                if (!online) {
+                    _session->append(ssid, uid);
+                    _status->append(uid);
+                }
+                })) {
+                return false;
+            }
+            if (online) {
+                response->set_errmsg("用户已在其它地方登录");
+                response->set_success(false);
+                return false;
+            }
+            response->set_login_session_id(ssid);
+            return true;
+        }
+
         std::shared_ptr<elasticlient::Client> _es;
-        std::shared_ptr<odb::database> _mysql;
+        DBRouter::Ptr _mysql;
         std::shared_ptr<sw::redis::Redis> _redis;
         ESUser::Ptr _es_user;
         UserTable::Ptr _user_table;
@@ -722,6 +919,9 @@ namespace blus {
         Discovery::Ptr _discovery;
         std::mt19937 _rng{ std::random_device{}() };
         TextClassifier::Ptr _text_classifier;
+        LoadSampler::Ptr _sampler;
+        IOExecutors _io;
+        ChangeEvents::Ptr _profile_events;
     };
 
     class UserServer {
@@ -745,12 +945,24 @@ namespace blus {
     public:
         UserServerBuilder(const std::string& file_service_name) : _file_service_name(file_service_name) {}
 
+        // 设置负载采样，需在make_etcd与make_rpc之前调用
+        bool make_load(int capacity_weight, int worker_threads) {
+            _sampler = std::make_shared<LoadSampler>(capacity_weight, worker_threads);
+            return true;
+        }
+
         // 设置es客户端
         bool make_es(const std::vector<std::string>& host_list) {
             _es = ESFactory::create(host_list);
             return true;
         }
 
+        // 设置阻塞I/O执行器(可选)，各后端的线程数<=0时在rpc线程直接执行，需在make_rpc之前调用
+        bool make_io(int mysql_threads, int es_threads, int redis_threads, int classifier_threads, int queue_size) {
+            _io = IOExecutors::create(mysql_threads, es_threads, redis_threads, classifier_threads, queue_size);
+            return true;
+        }
+
         // 设置mysql客户端
         bool make_mysql(const std::string& user,
             const std::string& pswd,
@@ -759,8 +971,9 @@ namespace blus {
             const std::string& sock_path = "",
             int conn_pool_count = 10,
             int port = 3306,
-            const std::string& cset = "utf8") {
-            _mysql = ODBFactory::create(user, pswd, db, host, sock_path, conn_pool_count, port, cset);
+            const std::string& cset = "utf8",
+            const std::string& replicas = "") {
+            _mysql = ODBFactory::create_router(user, pswd, db, host, sock_path, conn_pool_count, port, cset, replicas);
             return true;
         }
 
@@ -773,6 +986,13 @@ namespace blus {
             return true;
         }
 
+        // 设置rabbitmq(可选)，用于发布用户资料变更事件
+        bool make_rabbitmq(const std::string& user, const std::string& password, const std::string& host) {
+            _rabbitmq = std::make_shared<RabbitMQ>(user, password, host);
+            _profile_events = std::make_shared<ChangeEvents>(_rabbitmq, kProfileChangeExchange);
+            return true;
+        }
+
         // 设置邮件服务
         bool make_email(const std::string& from,
             const std::string& smtp,
@@ -789,18 +1009,26 @@ namespace blus {
             const std::string& instance_name,
             const std::string& service_ip,
             int32_t service_port,
-            int etcd_timeout) {
+            int etcd_timeout,
+            const std::string& snapshot_dir = "") {
             _service_manager = std::make_shared<ServiceManager>();
-            _service_manager->declare(_file_service_name);
+            // 文件节点磁盘性能差异大，使用耗时感知的P2C策略，批量读取头像开启对冲
+            HedgeOptions hedge;
+            hedge.enabled = true;
+            _service_manager->declare(_file_service_name, LoadBalancePolicy::P2C, hedge);
             _discovery = std::make_shared<Discovery>(_file_service_name, etcd_addr,
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->online(name, ip);
+                [this](const ServiceDiff& diff) {
+                    _service_manager->apply(diff.online, diff.offline);
                 },
-                [this](const std::string& name, const std::string& ip) {
-                    _service_manager->offline(name, ip);
-                });
+                [this](const std::string& key, const std::string& load) {
+                    _service_manager->update_load(key, load);
+                },
+                Discovery::snapshot_file(snapshot_dir, _file_service_name));
             _reg = make_shared<Registry>(user_service_name, etcd_addr, etcd_timeout);
             _reg->registry(instance_name, service_ip + ":" + to_string(service_port));
+            if (_sampler) {
+                _reg->report(instance_name, service_ip + ":" + to_string(service_port), _sampler);
+            }
             return true;
         }
 
@@ -809,7 +1037,7 @@ namespace blus {
             _server = make_shared<brpc::Server>();
 
             auto service = new UserServiceImpl(_es, _mysql, _redis, _email, _file_service_name, _service_manager, _discovery,
-                std::make_shared<TextClassifier>(classifier_ip, classifier_port, classifier_service_name));
+                std::make_shared<TextClassifier>(classifier_ip, classifier_port, classifier_service_name), _sampler, _io, _profile_events);
             int ret = _server->AddService(service, brpc::SERVER_OWNS_SERVICE);
             if (ret != 0) {
                 LOG_ERROR("UserServer添加服务失败");
@@ -854,12 +1082,16 @@ namespace blus {
     private:
         Registry::Ptr _reg;
         std::shared_ptr<elasticlient::Client> _es;
-        std::shared_ptr<odb::database> _mysql;
+        DBRouter::Ptr _mysql;
         std::shared_ptr<sw::redis::Redis> _redis;
         EmailSender::Ptr _email;
         ServiceManager::Ptr _service_manager;
         std::string _file_service_name;
         Discovery::Ptr _discovery;
         std::shared_ptr<brpc::Server> _server;
+        LoadSampler::Ptr _sampler;
+        IOExecutors _io;
+        RabbitMQ::Ptr _rabbitmq;
+        ChangeEvents::Ptr _profile_events;
     };
 }
\ No newline at end of file
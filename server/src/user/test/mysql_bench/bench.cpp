@@ -0,0 +1,77 @@
+// 预编译查询压测: 对比每次构造odb::query与使用连接上缓存的预编译查询时，按user_id查询用户的单次耗时
+// 需要可连接的mysql，测试数据写入test库的users表，结束后删除
+#include <gflags/gflags.h>
+#include <chrono>
+#include <vector>
+
+#include "user.hxx"
+#include "user-odb.hxx"
+#include "data_mysql.hpp"
+#include "logger.hpp"
+
+DEFINE_string(log_file, "", "日志文件路径, 默认输出到控制台");
+DEFINE_int32(log_level, 3, "日志等级, 0: trace, 1: debug, 2: info, 3: warn, 4: error, 5: critical");
+DEFINE_string(mysql_user, "root", "mysql服务器登录用户名");
+DEFINE_string(mysql_pswd, "", "mysql服务器登录密码");
+DEFINE_string(mysql_db, "test", "mysql数据库名称");
+DEFINE_string(mysql_host, "localhost", "mysql服务器地址");
+DEFINE_string(mysql_socket, "/var/run/mysqld/mysqld.sock", "mysql socket路径");
+DEFINE_int32(users, 1000, "测试用户数");
+DEFINE_int32(rounds, 10, "每种方式遍历全部用户的轮数");
+
+// 改动前的实现: 每次调用构造查询条件，由数据库解析并规划SQL
+std::shared_ptr<blus::User> select_unprepared(const std::shared_ptr<odb::database>& db, const std::string& user_id) {
+    odb::transaction trans(db->begin());
+    using query = odb::query<blus::User>;
+    std::shared_ptr<blus::User> res(db->query_one<blus::User>(query::user_id == user_id));
+    trans.commit();
+    return res;
+}
+
+template <typename Fn>
+double measure(const std::vector<std::string>& ids, Fn fn) {
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < FLAGS_rounds; ++r) {
+        for (const auto& id : ids) {
+            found += fn(id) != nullptr;
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    size_t calls = ids.size() * FLAGS_rounds;
+    if (found != calls) {
+        LOG_ERROR("查询结果不完整: {}/{}", found, calls);
+    }
+    return static_cast<double>(elapsed) / calls;
+}
+
+int main(int argc, char* argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    blus::init_logger(FLAGS_log_file, static_cast<spdlog::level::level_enum>(FLAGS_log_level));
+
+    // 连接池只保留一个连接，保证预编译查询总在同一连接上命中缓存
+    auto db = blus::ODBFactory::create(FLAGS_mysql_user, FLAGS_mysql_pswd, FLAGS_mysql_db, FLAGS_mysql_host, FLAGS_mysql_socket, 1);
+    blus::UserTable table(db);
+    std::vector<std::string> ids;
+    for (int i = 0; i < FLAGS_users; ++i) {
+        ids.push_back("bench_uid_" + std::to_string(i));
+        table.insert(blus::User(ids.back(), "bench_nickname_" + std::to_string(i), "123456"));
+    }
+
+    // 预热: 建立连接并生成预编译查询
+    select_unprepared(db, ids.front());
+    table.select_by_uid(ids.front());
+
+    double unprepared = measure(ids, [&](const std::string& id) { return select_unprepared(db, id); });
+    double prepared = measure(ids, [&](const std::string& id) { return table.select_by_uid(id); });
+    std::cout << "calls: " << ids.size() * FLAGS_rounds << std::endl;
+    std::cout << "unprepared: " << unprepared << " us/call" << std::endl;
+    std::cout << "prepared:   " << prepared << " us/call" << std::endl;
+    std::cout << "saved:      " << unprepared - prepared << " us/call ("
+        << (unprepared > 0 ? (unprepared - prepared) * 100 / unprepared : 0) << "%)" << std::endl;
+
+    for (const auto& id : ids) {
+        table.remove(id);
+    }
+    return 0;
+}
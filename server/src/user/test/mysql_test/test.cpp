@@ -48,6 +48,33 @@ TEST(odb, update) {
     ASSERT_EQ(r1->password(), user1->password());
     ASSERT_EQ(r2->user_id(), user2->user_id());
     ASSERT_EQ(r2->email(), user2->email());
+    // 读-改-写从主库读取
+    auto w1 = g_user_table->select_by_uid_primary(user1->user_id());
+    ASSERT_NE(w1, nullptr);
+    ASSERT_EQ(w1->nickname(), user1->nickname());
+}
+
+TEST(odb, select_users) {
+    // 超过单块上限，覆盖分块查询
+    std::vector<std::string> ids;
+    for (int i = 0; i < 250; ++i) {
+        ids.push_back("bulk_uid" + std::to_string(i));
+        g_user_table->insert(blus::User(ids.back(), "bulk_nickname" + std::to_string(i), "123456"));
+    }
+    auto query_ids = ids;
+    query_ids.push_back(ids.front());
+    query_ids.push_back("bulk_uid_not_exist");
+    std::unordered_map<std::string, std::shared_ptr<blus::User>> users;
+    ASSERT_TRUE(g_user_table->select_users(query_ids, users));
+    ASSERT_EQ(users.size(), ids.size());
+    for (const auto& id : ids) {
+        ASSERT_EQ(users.count(id), 1);
+        ASSERT_EQ(users[id]->user_id(), id);
+    }
+    ASSERT_EQ(users.count("bulk_uid_not_exist"), 0);
+    for (const auto& id : ids) {
+        g_user_table->remove(id);
+    }
 }
 
 int main(int argc, char* argv[]) {
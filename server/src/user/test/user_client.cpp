@@ -256,6 +256,17 @@ TEST_F(UserServiceTest, GetUserInfo) {
     EXPECT_EQ(user_info.nickname(), "NewNickname");
     EXPECT_EQ(user_info.description(), "我就是我，不一样的烟火");
     EXPECT_EQ(user_info.avatar(), "测试头像数据");
+    EXPECT_EQ(user_info.avatar_hash(), blus::sha256("测试头像数据"));
+
+    // LITE模式不返回头像内容
+    cntl.Reset();
+    request.set_view(blus::USER_INFO_LITE);
+    stub.GetUserInfo(&cntl, &request, &response, nullptr);
+    ASSERT_FALSE(cntl.Failed());
+    ASSERT_TRUE(response.success());
+    EXPECT_TRUE(response.user_info().avatar().empty());
+    EXPECT_FALSE(response.user_info().avatar_id().empty());
+    EXPECT_EQ(response.user_info().avatar_hash(), blus::sha256("测试头像数据"));
 }
 
 TEST_F(UserServiceTest, GetMultiUserInfo) {